@@ -0,0 +1,180 @@
+/*============================================================================
+
+  fbclock
+  bitmap_font.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  The font tables store each glyph row as whole bytes, most significant
+  bit first, which has to be unpicked a bit at a time. The first time
+  a font is used, its glyphs are expanded into one word per row, with
+  bit n set if column n is inked, so that a row can be drawn eight
+  pixels at a time.
+
+  Fonts that are to be drawn at sizes other than their own are turned,
+  also on first use, into signed distance fields: for each pixel of 
+  each glyph, and a border around it, how far its centre is from the 
+  glyph's edge. Scaling the field up with bilinear interpolation, and
+  taking the points where it is positive, gives a glyph that is smooth 
+  at any size, without steps along its diagonals.
+
+============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "defs.h"
+#include "log.h"
+#include "bitmap_font.h"
+
+#define GLYPHS (BITMAP_FONT_LAST - BITMAP_FONT_FIRST + 1)
+
+typedef struct _ExpandedFont
+  {
+  const BitmapFont *font;
+  uint32_t *rows;
+  BYTE *sdf;
+  } ExpandedFont;
+
+// One for each font that has been used; there are only five fonts
+static ExpandedFont *expanded = NULL;
+static int n_expanded = 0;
+
+
+/*==========================================================================
+  bitmap_font_expand
+*==========================================================================*/
+static uint32_t *bitmap_font_expand (const BitmapFont *bf)
+  {
+  LOG_IN
+  int row_bytes = (bf->width + 7) / 8;
+  uint32_t *rows = malloc (GLYPHS * bf->height * sizeof (uint32_t));
+  const uint8_t *ptr = bf->table;
+  for (int i = 0; i < GLYPHS * bf->height; i++, ptr += row_bytes)
+    {
+    uint32_t bits = 0;
+    for (int column = 0; column < bf->width; column++)
+      {
+      if (ptr[column / 8] & (0x80 >> (column % 8)))
+        bits |= 1u << column;
+      }
+    rows[i] = bits;
+    }
+  LOG_OUT
+  return rows;
+  }
+
+
+// Whether the pixel at (x,y) of an expanded glyph is inked. Pixels 
+//   outside the glyph are not
+static inline BOOL glyph_inked (const BitmapFont *bf, const uint32_t *glyph,
+      int x, int y)
+  {
+  return x >= 0 && x < bf->width && y >= 0 && y < bf->height 
+    && (glyph[y] >> x & 1);
+  }
+
+
+/*==========================================================================
+
+  bitmap_font_make_sdf
+
+  Work out the distance field from the expanded rows. The distance 
+  from a pixel's centre to the edge is taken to be half a pixel less
+  than the distance to the nearest pixel that is inked differently, 
+  so that the edge falls halfway between them. Distances are only
+  measured a pixel beyond the border: further than that, a sample and
+  its neighbours are all well outside or inside the glyph, so the 
+  exact distance makes no difference to where the edge is drawn
+
+*==========================================================================*/
+static BYTE *bitmap_font_make_sdf (const BitmapFont *bf, 
+      const uint32_t *rows)
+  {
+  LOG_IN
+  const int b = BITMAP_FONT_SDF_BORDER;
+  const int reach = BITMAP_FONT_SDF_BORDER + 1;
+  int gw = bf->width + 2 * b;
+  int gh = bf->height + 2 * b;
+  BYTE *sdf = malloc (GLYPHS * gw * gh);
+  for (int g = 0; g < GLYPHS; g++)
+    {
+    const uint32_t *glyph = rows + g * bf->height;
+    BYTE *out = sdf + g * gw * gh;
+    for (int y = -b; y < bf->height + b; y++)
+      for (int x = -b; x < bf->width + b; x++)
+        {
+        BOOL inked = glyph_inked (bf, glyph, x, y);
+        int nearest = (reach + 1) * (reach + 1);
+        for (int dy = -reach; dy <= reach; dy++)
+          for (int dx = -reach; dx <= reach; dx++)
+            {
+            if (glyph_inked (bf, glyph, x + dx, y + dy) != inked 
+                 && dx * dx + dy * dy < nearest)
+              nearest = dx * dx + dy * dy;
+            }
+        double d = (sqrt (nearest) - 0.5) * BITMAP_FONT_SDF_ONE;
+        int v = inked ? 128 + (int) lround (d) : 128 - (int) lround (d);
+        out[(y + b) * gw + x + b] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+  LOG_OUT
+  return sdf;
+  }
+
+
+/*==========================================================================
+
+  bitmap_font_find
+
+  The expansion of the font, which is made if this is the first time 
+  it has been used
+
+*==========================================================================*/
+static ExpandedFont *bitmap_font_find (const BitmapFont *bf)
+  {
+  for (int i = 0; i < n_expanded; i++)
+    {
+    if (expanded[i].font == bf)
+      return &expanded[i];
+    }
+  expanded = realloc (expanded, (n_expanded + 1) * sizeof (ExpandedFont));
+  expanded[n_expanded].font = bf;
+  expanded[n_expanded].rows = bitmap_font_expand (bf);
+  expanded[n_expanded].sdf = NULL;
+  return &expanded[n_expanded++];
+  }
+
+
+/*==========================================================================
+
+  bitmap_font_get_rows
+
+  The expanded glyphs of the font: bf->height words for each character
+  from BITMAP_FONT_FIRST to BITMAP_FONT_LAST. Fonts wider than 32
+  pixels are not supported. The expansion is kept until the program
+  exits
+
+*==========================================================================*/
+const uint32_t *bitmap_font_get_rows (const BitmapFont *bf)
+  {
+  return bitmap_font_find (bf)->rows;
+  }
+
+
+/*==========================================================================
+
+  bitmap_font_get_sdf
+
+  The signed distance fields of the glyphs, one after another, in the
+  same order as bitmap_font_get_rows. Each is a byte for each pixel of
+  the glyph, and of a border BITMAP_FONT_SDF_BORDER pixels wide around
+  it, row by row. The fields are kept until the program exits
+
+*==========================================================================*/
+const BYTE *bitmap_font_get_sdf (const BitmapFont *bf)
+  {
+  ExpandedFont *e = bitmap_font_find (bf);
+  if (!e->sdf) e->sdf = bitmap_font_make_sdf (bf, e->rows);
+  return e->sdf;
+  }
+
@@ -23,7 +23,21 @@ extern BitmapFont font16;
 extern BitmapFont font20;
 extern BitmapFont font24;
 
+// The fonts cover the printable ASCII characters, from space to tilde
+#define BITMAP_FONT_FIRST ' '
+#define BITMAP_FONT_LAST '~'
+
+// Signed distance fields, made from the fonts for drawing them at other
+//   sizes, extend this many pixels beyond each glyph, and have this many
+//   steps per pixel of distance. The value at a pixel is 128 plus its
+//   distance from the edge of the glyph, positive inside
+#define BITMAP_FONT_SDF_BORDER 2
+#define BITMAP_FONT_SDF_ONE 16
+
 BEGIN_DECLS
 
+const uint32_t *bitmap_font_get_rows (const BitmapFont *bf);
+const BYTE     *bitmap_font_get_sdf (const BitmapFont *bf);
+
 END_DECLS
 
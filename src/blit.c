@@ -0,0 +1,474 @@
+/*============================================================================
+
+  fbclock
+  blit.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Row kernels for moving pixels between a Region and the framebuffer.
+  There is one pair of kernels (write and read) for each pixel layout
+  we know about, so that no pixel has to be taken apart channel-by-channel
+  using the generic bitfield information on the hot path. The framebuffer
+  works out which layout it has, once, when it is initialized.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/fb.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+#include "defs.h"
+#include "log.h"
+#include "blit.h"
+
+/*==========================================================================
+
+  RGB565 -- red in the top five bits, as used by most SPI panels
+
+*==========================================================================*/
+static void write_row_rgb565 (BYTE *dst, const BYTE *src, int n)
+  {
+  uint16_t *d = (uint16_t *)dst;
+  for (int i = 0; i < n; i++)
+    {
+    BYTE b = *src++;
+    BYTE g = *src++;
+    BYTE r = *src++;
+    d[i] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    }
+  }
+
+static void read_row_rgb565 (BYTE *dst, const BYTE *src, int n)
+  {
+  const uint16_t *s = (const uint16_t *)src;
+  for (int i = 0; i < n; i++)
+    {
+    uint16_t v = s[i];
+    BYTE r = (v >> 11) & 0x1F;
+    BYTE g = (v >> 5) & 0x3F;
+    BYTE b = v & 0x1F;
+    *dst++ = (b << 3) | (b >> 2);
+    *dst++ = (g << 2) | (g >> 4);
+    *dst++ = (r << 3) | (r >> 2);
+    }
+  }
+
+/*==========================================================================
+
+  BGR565 -- as RGB565, but with red and blue exchanged
+
+*==========================================================================*/
+static void write_row_bgr565 (BYTE *dst, const BYTE *src, int n)
+  {
+  uint16_t *d = (uint16_t *)dst;
+  for (int i = 0; i < n; i++)
+    {
+    BYTE b = *src++;
+    BYTE g = *src++;
+    BYTE r = *src++;
+    d[i] = ((b & 0xF8) << 8) | ((g & 0xFC) << 3) | (r >> 3);
+    }
+  }
+
+static void read_row_bgr565 (BYTE *dst, const BYTE *src, int n)
+  {
+  const uint16_t *s = (const uint16_t *)src;
+  for (int i = 0; i < n; i++)
+    {
+    uint16_t v = s[i];
+    BYTE b = (v >> 11) & 0x1F;
+    BYTE g = (v >> 5) & 0x3F;
+    BYTE r = v & 0x1F;
+    *dst++ = (b << 3) | (b >> 2);
+    *dst++ = (g << 2) | (g >> 4);
+    *dst++ = (r << 3) | (r >> 2);
+    }
+  }
+
+/*==========================================================================
+
+  RGB888 -- three bytes per pixel, blue in the lowest byte. This is
+  byte-for-byte the same as packed BGR, so both directions are a 
+  straight copy
+
+*==========================================================================*/
+static void copy_row_rgb888 (BYTE *dst, const BYTE *src, int n)
+  {
+  memcpy (dst, src, n * 3);
+  }
+
+/*==========================================================================
+
+  XRGB8888 -- the common 32bpp layout. We fill the unused byte with
+  0xFF, so the kernel works equally for ARGB8888 panels, and so that
+  every store is a complete 32-bit word
+
+*==========================================================================*/
+static void write_row_xrgb8888 (BYTE *dst, const BYTE *src, int n)
+  {
+  uint32_t *d = (uint32_t *)dst;
+  for (int i = 0; i < n; i++)
+    {
+    d[i] = 0xFF000000 | (src[2] << 16) | (src[1] << 8) | src[0];
+    src += 3;
+    }
+  }
+
+static void read_row_xrgb8888 (BYTE *dst, const BYTE *src, int n)
+  {
+  const uint32_t *s = (const uint32_t *)src;
+  for (int i = 0; i < n; i++)
+    {
+    uint32_t v = s[i];
+    *dst++ = v;
+    *dst++ = v >> 8;
+    *dst++ = v >> 16;
+    }
+  }
+
+/*==========================================================================
+
+  ABGR8888 -- red in the lowest byte, opaque alpha in the highest
+
+*==========================================================================*/
+static void write_row_abgr8888 (BYTE *dst, const BYTE *src, int n)
+  {
+  uint32_t *d = (uint32_t *)dst;
+  for (int i = 0; i < n; i++)
+    {
+    d[i] = 0xFF000000 | (src[0] << 16) | (src[1] << 8) | src[2];
+    src += 3;
+    }
+  }
+
+static void read_row_abgr8888 (BYTE *dst, const BYTE *src, int n)
+  {
+  const uint32_t *s = (const uint32_t *)src;
+  for (int i = 0; i < n; i++)
+    {
+    uint32_t v = s[i];
+    *dst++ = v >> 16;
+    *dst++ = v >> 8;
+    *dst++ = v;
+    }
+  }
+
+/*==========================================================================
+
+  Store kernels
+
+  Framebuffer memory is usually mapped uncached or write-combined. In
+  either case, partial and narrow writes are expensive -- a write-
+  combining buffer that is flushed before it is full costs as much as
+  one that is full. So, apart from the plain memcpy, these kernels 
+  write the few bytes needed to reach an aligned address, and then
+  whole aligned words or vectors: 8-byte words for aligned8, and 
+  16-byte vectors for the SSE2 and NEON versions. The SSE2 version 
+  uses non-temporal stores, which go straight to the write-combining
+  buffers without reading the cache line first. The NEON version uses
+  ordinary stores, two vectors at a time, since the intrinsics have no
+  non-temporal store.
+
+*==========================================================================*/
+static void store_memcpy (BYTE *dst, const BYTE *src, int n)
+  {
+  memcpy (dst, src, n);
+  }
+
+static void store_aligned8 (BYTE *dst, const BYTE *src, int n)
+  {
+  while (n > 0 && ((uintptr_t)dst & 7))
+    {
+    *dst++ = *src++;
+    n--;
+    }
+  uint64_t *d = (uint64_t *)dst;
+  while (n >= 8)
+    {
+    uint64_t v;
+    memcpy (&v, src, 8);
+    *d++ = v;
+    src += 8;
+    n -= 8;
+    }
+  dst = (BYTE *)d;
+  while (n-- > 0)
+    *dst++ = *src++;
+  }
+
+#ifdef __SSE2__
+static void store_sse2_nt (BYTE *dst, const BYTE *src, int n)
+  {
+  while (n > 0 && ((uintptr_t)dst & 15))
+    {
+    *dst++ = *src++;
+    n--;
+    }
+  __m128i *d = (__m128i *)dst;
+  while (n >= 16)
+    {
+    _mm_stream_si128 (d++, _mm_loadu_si128 ((const __m128i *)src));
+    src += 16;
+    n -= 16;
+    }
+  _mm_sfence ();
+  dst = (BYTE *)d;
+  while (n-- > 0)
+    *dst++ = *src++;
+  }
+#endif
+
+#ifdef __ARM_NEON
+static void store_neon (BYTE *dst, const BYTE *src, int n)
+  {
+  while (n > 0 && ((uintptr_t)dst & 15))
+    {
+    *dst++ = *src++;
+    n--;
+    }
+  while (n >= 32)
+    {
+    uint8x16_t a = vld1q_u8 (src);
+    uint8x16_t b = vld1q_u8 (src + 16);
+    vst1q_u8 (dst, a);
+    vst1q_u8 (dst + 16, b);
+    src += 32;
+    dst += 32;
+    n -= 32;
+    }
+  while (n-- > 0)
+    *dst++ = *src++;
+  }
+#endif
+
+// The first entry is the default, used if the framebuffer does not
+//   probe for the best
+static const BlitStore stores[] =
+  {
+  { "memcpy", store_memcpy },
+  { "aligned8", store_aligned8 },
+#ifdef __SSE2__
+  { "sse2-nt", store_sse2_nt },
+#endif
+#ifdef __ARM_NEON
+  { "neon", store_neon },
+#endif
+  };
+
+
+// Indexed by PixelFormat
+static const BlitKernels kernels[] =
+  {
+  { PIXEL_FORMAT_RGB565, "RGB565", 2, write_row_rgb565, read_row_rgb565 },
+  { PIXEL_FORMAT_BGR565, "BGR565", 2, write_row_bgr565, read_row_bgr565 },
+  { PIXEL_FORMAT_RGB888, "RGB888", 3, copy_row_rgb888, copy_row_rgb888 },
+  { PIXEL_FORMAT_XRGB8888, "XRGB8888", 4,
+      write_row_xrgb8888, read_row_xrgb8888 },
+  { PIXEL_FORMAT_ABGR8888, "ABGR8888", 4,
+      write_row_abgr8888, read_row_abgr8888 },
+  };
+
+
+/*==========================================================================
+
+  blit_format_from_screeninfo
+
+  Work out the pixel layout from the bitfield offsets and lengths that
+  the driver reports. If the layout is not one we have kernels for,
+  we log a warning and guess from the depth alone, which is what the
+  program always did before
+
+*==========================================================================*/
+PixelFormat blit_format_from_screeninfo (const struct fb_var_screeninfo *v)
+  {
+  LOG_IN
+  PixelFormat ret;
+  int bpp = v->bits_per_pixel;
+  int ro = v->red.offset, go = v->green.offset, bo = v->blue.offset;
+  int rl = v->red.length, gl = v->green.length, bl = v->blue.length;
+
+  if (bpp == 16 && rl == 5 && gl == 6 && bl == 5
+       && ro == 11 && go == 5 && bo == 0)
+    ret = PIXEL_FORMAT_RGB565;
+  else if (bpp == 16 && rl == 5 && gl == 6 && bl == 5
+       && ro == 0 && go == 5 && bo == 11)
+    ret = PIXEL_FORMAT_BGR565;
+  else if (bpp == 24 && rl == 8 && gl == 8 && bl == 8
+       && ro == 16 && go == 8 && bo == 0)
+    ret = PIXEL_FORMAT_RGB888;
+  else if (bpp == 32 && rl == 8 && gl == 8 && bl == 8
+       && ro == 16 && go == 8 && bo == 0)
+    ret = PIXEL_FORMAT_XRGB8888;
+  else if (bpp == 32 && rl == 8 && gl == 8 && bl == 8
+       && ro == 0 && go == 8 && bo == 16)
+    ret = PIXEL_FORMAT_ABGR8888;
+  else
+    {
+    if (bpp == 16)
+      ret = PIXEL_FORMAT_RGB565;
+    else if (bpp == 24)
+      ret = PIXEL_FORMAT_RGB888;
+    else
+      ret = PIXEL_FORMAT_XRGB8888;
+    log_warning ("Unrecognized pixel layout: %d bpp, "
+      "red %d/%d, green %d/%d, blue %d/%d; assuming %s",
+      bpp, ro, rl, go, gl, bo, bl, kernels[ret].name);
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  blit_format_to_screeninfo
+
+  Fill in the depth and bitfields of a screeninfo structure, as a 
+  driver with the specified layout would. This is the inverse of
+  blit_format_from_screeninfo
+
+*==========================================================================*/
+void blit_format_to_screeninfo (PixelFormat format, 
+      struct fb_var_screeninfo *v)
+  {
+  memset (&v->red, 0, sizeof (v->red));
+  memset (&v->green, 0, sizeof (v->green));
+  memset (&v->blue, 0, sizeof (v->blue));
+  memset (&v->transp, 0, sizeof (v->transp));
+  v->bits_per_pixel = kernels[format].bytes_per_pixel * 8;
+  switch (format)
+    {
+    case PIXEL_FORMAT_RGB565:
+    case PIXEL_FORMAT_BGR565:
+      v->red.length = 5; v->green.length = 6; v->blue.length = 5;
+      v->green.offset = 5;
+      if (format == PIXEL_FORMAT_RGB565)
+        v->red.offset = 11;
+      else
+        v->blue.offset = 11;
+      break;
+    case PIXEL_FORMAT_ABGR8888:
+      v->red.length = v->green.length = v->blue.length = 8;
+      v->green.offset = 8; v->blue.offset = 16; 
+      v->transp.length = 8; v->transp.offset = 24; 
+      break;
+    case PIXEL_FORMAT_RGB888:
+    case PIXEL_FORMAT_XRGB8888:
+      v->red.length = v->green.length = v->blue.length = 8;
+      v->red.offset = 16; v->green.offset = 8; 
+      break;
+    }
+  }
+
+
+/*==========================================================================
+
+  blit_format_from_name
+
+  Look up a layout by its name (RGB565, etc), ignoring case. Returns
+  FALSE if the name is not known
+
+*==========================================================================*/
+BOOL blit_format_from_name (const char *name, PixelFormat *format)
+  {
+  for (int i = 0; i < sizeof (kernels) / sizeof (kernels[0]); i++)
+    {
+    if (strcasecmp (kernels[i].name, name) == 0)
+      {
+      *format = kernels[i].format;
+      return TRUE;
+      }
+    }
+  return FALSE;
+  }
+
+
+/*==========================================================================
+  blit_get_kernels
+*==========================================================================*/
+const BlitKernels *blit_get_kernels (PixelFormat format)
+  {
+  return &kernels[format];
+  }
+
+
+/*==========================================================================
+  blit_get_stores
+*==========================================================================*/
+const BlitStore *blit_get_stores (int *count)
+  {
+  *count = sizeof (stores) / sizeof (stores[0]);
+  return stores;
+  }
+
+
+/*==========================================================================
+
+  blit_pack_pixel
+
+  Turn a colour into a pixel value in the specified layout. The value
+  is in host byte order, and occupies the low bytes_per_pixel bytes
+
+*==========================================================================*/
+uint32_t blit_pack_pixel (PixelFormat format, BYTE r, BYTE g, BYTE b)
+  {
+  switch (format)
+    {
+    case PIXEL_FORMAT_RGB565:
+      return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    case PIXEL_FORMAT_BGR565:
+      return ((b & 0xF8) << 8) | ((g & 0xFC) << 3) | (r >> 3);
+    case PIXEL_FORMAT_RGB888:
+      return (r << 16) | (g << 8) | b;
+    case PIXEL_FORMAT_ABGR8888:
+      return 0xFF000000 | (b << 16) | (g << 8) | r;
+    case PIXEL_FORMAT_XRGB8888:
+    default:
+      return 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+  }
+
+
+/*==========================================================================
+  blit_unpack_pixel
+*==========================================================================*/
+void blit_unpack_pixel (PixelFormat format, uint32_t v, 
+       BYTE *r, BYTE *g, BYTE *b)
+  {
+  BYTE t;
+  switch (format)
+    {
+    case PIXEL_FORMAT_RGB565:
+    case PIXEL_FORMAT_BGR565:
+      t = (v >> 11) & 0x1F;
+      *r = (t << 3) | (t >> 2);
+      t = (v >> 5) & 0x3F;
+      *g = (t << 2) | (t >> 4);
+      t = v & 0x1F;
+      *b = (t << 3) | (t >> 2);
+      if (format == PIXEL_FORMAT_BGR565)
+        {
+        t = *r; *r = *b; *b = t;
+        }
+      break;
+    case PIXEL_FORMAT_ABGR8888:
+      *r = v;
+      *g = v >> 8;
+      *b = v >> 16;
+      break;
+    case PIXEL_FORMAT_RGB888:
+    case PIXEL_FORMAT_XRGB8888:
+    default:
+      *r = v >> 16;
+      *g = v >> 8;
+      *b = v;
+    }
+  }
+
@@ -0,0 +1,72 @@
+/*============================================================================
+
+  fbclock
+  blit.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <linux/fb.h>
+#include "defs.h"
+
+// The pixel layouts for which we have specialised row kernels. The names
+//   follow the usual convention of listing the channels from the most-
+//   significant bits of the pixel value to the least-significant
+typedef enum _PixelFormat
+  {
+  PIXEL_FORMAT_RGB565 = 0,
+  PIXEL_FORMAT_BGR565,
+  PIXEL_FORMAT_RGB888,
+  PIXEL_FORMAT_XRGB8888,
+  PIXEL_FORMAT_ABGR8888
+  } PixelFormat;
+
+// A row kernel converts n pixels from src to dst. A write kernel
+//   converts from packed three-byte BGR to the specific layout; a read 
+//   kernel does the opposite. They are only needed when the source and 
+//   destination layouts differ -- otherwise a row is just copied
+typedef void (*BlitRowFn) (BYTE *dst, const BYTE *src, int n);
+
+typedef struct _BlitKernels
+  {
+  PixelFormat format;
+  const char *name;
+  int bytes_per_pixel;
+  BlitRowFn write_row;
+  BlitRowFn read_row;
+  } BlitKernels;
+
+// A store kernel copies n bytes, already in the right layout, to the
+//   framebuffer. They differ in how they write the framebuffer memory,
+//   which is usually uncached or write-combined, so that the best one 
+//   can only be found by trying them
+typedef void (*BlitStoreFn) (BYTE *dst, const BYTE *src, int n);
+
+// The most bytes that any store kernel writes at once
+#define BLIT_STORE_WIDTH 16
+
+typedef struct _BlitStore
+  {
+  const char *name;
+  BlitStoreFn store;
+  } BlitStore;
+
+BEGIN_DECLS
+
+PixelFormat        blit_format_from_screeninfo
+                      (const struct fb_var_screeninfo *vinfo);
+void               blit_format_to_screeninfo (PixelFormat format,
+                      struct fb_var_screeninfo *vinfo);
+BOOL               blit_format_from_name (const char *name, 
+                      PixelFormat *format);
+const BlitKernels *blit_get_kernels (PixelFormat format);
+uint32_t           blit_pack_pixel (PixelFormat format, 
+                      BYTE r, BYTE g, BYTE b);
+const BlitStore   *blit_get_stores (int *count);
+void               blit_unpack_pixel (PixelFormat format, uint32_t v,
+                      BYTE *r, BYTE *g, BYTE *b);
+
+END_DECLS
+
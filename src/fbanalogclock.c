@@ -16,7 +16,6 @@
 #include <getopt.h>
 #include <time.h>
 #include <signal.h>
-#include <math.h>
 #include "feature.h" 
 #include "fbanalogclock.h" 
 #include "string.h" 
@@ -24,23 +23,194 @@
 #include "list.h" 
 #include "framebuffer.h"
 #include "region.h"
+#include "spritecache.h"
+#include "trig.h"
+
+// Hand sprites are cached separately for each size of clock, so outputs
+//   with the same size share them
+#define MAX_HAND_CACHES 8
+
+typedef struct _HandCache
+  {
+  int w;
+  int h;
+  SpriteCache *cache;
+  } HandCache;
+
+static HandCache hand_caches[MAX_HAND_CACHES];
+static int n_hand_caches = 0;
+static long hand_cache_budget = 0;
+
+// Clocks with a radius of at least this many pixels have their text 
+//   drawn from the largest font, scaled up, rather than from a font of 
+//   the right size, because there isn't one
+#define SCALED_TEXT_RADIUS 175
+
+// The font that the numerals and date are drawn in, and the size the 
+//   characters are drawn at, which is the font's own size unless it is
+//   scaled
+typedef struct _ClockFont
+  {
+  const BitmapFont *font;
+  int width;
+  int height;
+  } ClockFont;
+
+// Everything needed to draw one hand
+typedef struct _HandSpec
+  {
+  int angle;
+  int cx;
+  int cy;
+  int thickness;
+  int l;
+  } HandSpec;
+
+/*==========================================================================
+
+  draw_hand
+
+  Draw a hand as a solid shape, thickness pixels wide at the tail, 
+  which sticks out a tenth of its length behind the centre, and 
+  tapering to half that at the tip. A hand one pixel thick doesn't 
+  taper
+
+==========================================================================*/
+static void draw_hand (Region *r, int angle, 
+     int cx, int cy, int thickness, int l, BYTE cr, BYTE cg, BYTE cb)
+  {
+  // Unit vectors along the hand, and across it. y is downwards
+  int32_t ux = trig_sin (angle);
+  int32_t uy = -trig_cos (angle);
+  int32_t nx = -uy;
+  int32_t ny = ux;
+
+  // All lengths in subpixels. The centre is the middle of pixel cx,cy
+  int ox = cx * REGION_SUBPIXEL + REGION_SUBPIXEL / 2;
+  int oy = cy * REGION_SUBPIXEL + REGION_SUBPIXEL / 2;
+  int tip = l * REGION_SUBPIXEL;
+  int tail = -l / 10 * REGION_SUBPIXEL;
+  int w_tail = thickness * REGION_SUBPIXEL / 2;
+  int w_tip = thickness > 1 ? w_tail / 2 : w_tail;
+
+  int points[8] =
+    {
+    ox + trig_mul (tail, ux) + trig_mul (w_tail, nx),
+    oy + trig_mul (tail, uy) + trig_mul (w_tail, ny),
+    ox + trig_mul (tip, ux) + trig_mul (w_tip, nx),
+    oy + trig_mul (tip, uy) + trig_mul (w_tip, ny),
+    ox + trig_mul (tip, ux) - trig_mul (w_tip, nx),
+    oy + trig_mul (tip, uy) - trig_mul (w_tip, ny),
+    ox + trig_mul (tail, ux) - trig_mul (w_tail, nx),
+    oy + trig_mul (tail, uy) - trig_mul (w_tail, ny),
+    };
+  region_fill_polygon (r, points, 4, cr, cg, cb);
+  }
+
+
+/*==========================================================================
+
+  render_hand
+
+  The SpriteRenderFn for the hands
+
+==========================================================================*/
+static void render_hand (Region *r, const void *arg, 
+     BYTE cr, BYTE cg, BYTE cb)
+  {
+  const HandSpec *hand = arg;
+  draw_hand (r, hand->angle, hand->cx, hand->cy, hand->thickness, 
+    hand->l, cr, cg, cb);
+  }
 
-static const double TWOPI = 2.0 * M_PI;
 
 /*==========================================================================
 
-  draw_clock_in_region
+  get_hand_cache
+
+  Find the sprite cache for clocks the size of r, creating it if 
+  necessary. Returns NULL if hand sprites are not being cached
 
 ==========================================================================*/
-static void draw_hand (Region *r, double angle, 
+static SpriteCache *get_hand_cache (const Region *r)
+  {
+  if (hand_cache_budget <= 0) return NULL;
+  int w = region_get_width (r);
+  int h = region_get_height (r);
+  for (int i = 0; i < n_hand_caches; i++)
+    {
+    if (hand_caches[i].w == w && hand_caches[i].h == h)
+      return hand_caches[i].cache;
+    }
+  if (n_hand_caches == MAX_HAND_CACHES) return NULL;
+  HandCache *hc = &hand_caches[n_hand_caches++];
+  hc->w = w;
+  hc->h = h;
+  hc->cache = sprite_cache_create (w, h, hand_cache_budget);
+  return hc->cache;
+  }
+
+
+/*==========================================================================
+
+  draw_hand_cached
+
+  Draw a hand, from the sprite cache if there is one. key identifies
+  the hand and its position; everything else is fixed by the size of
+  the region
+
+==========================================================================*/
+static void draw_hand_cached (Region *r, int key, int angle, 
      int cx, int cy, int thickness, int l, BYTE cr, BYTE cg, BYTE cb)
   {
-  int lx = l * sin (angle);
-  int ly = l * cos (angle);
-  int lxh = l / 10 * sin (angle + M_PI);
-  int lyh = l / 10 * cos (angle + M_PI);
-  region_draw_hollow_line (r, cx + lxh, cy - lyh, 
-     cx + lx, cy - ly, thickness, cr, cg, cb);
+  HandSpec hand = { angle, cx, cy, thickness, l };
+  SpriteCache *cache = get_hand_cache (r);
+  if (cache)
+    sprite_cache_draw (cache, r, key, render_hand, &hand, cr, cg, cb);
+  else
+    render_hand (r, &hand, cr, cg, cb);
+  }
+
+
+/*==========================================================================
+
+  program_set_hand_cache_budget
+
+  Set the most memory, in bytes, that the sprites for each size of 
+  clock may take. Zero turns off the cache. This has to be called 
+  before anything is drawn
+
+==========================================================================*/
+void program_set_hand_cache_budget (long budget)
+  {
+  hand_cache_budget = budget;
+  }
+
+
+/*==========================================================================
+  program_free_clock_caches
+==========================================================================*/
+void program_free_clock_caches (void)
+  {
+  for (int i = 0; i < n_hand_caches; i++)
+    sprite_cache_destroy (hand_caches[i].cache);
+  n_hand_caches = 0;
+  }
+
+
+/*==========================================================================
+
+  draw_text
+
+==========================================================================*/
+static void draw_text (Region *r, const ClockFont *font, const char *s,
+     int x, int y, BYTE cr, BYTE cg, BYTE cb)
+  {
+  if (font->height == font->font->height)
+    region_draw_bitmap_text (r, font->font, s, x, y, cr, cg, cb); 
+  else
+    region_draw_scaled_text (r, font->font, s, x, y, font->height, 
+      cr, cg, cb); 
   }
 
 
@@ -49,19 +219,16 @@ static void draw_hand (Region *r, double angle,
   draw_date
 
 ==========================================================================*/
-static void draw_date (Region *r, int l, int cx, int cy, 
-     BYTE cr, BYTE cg, BYTE cb, const BitmapFont *font)
+static void draw_date (Region *r, const struct tm *tm, int l, int cx, 
+     int cy, BYTE cr, BYTE cg, BYTE cb, const ClockFont *font)
   {
   int text_height = font->height;
   int text_width = font->width;
-  time_t t = time (NULL);
-  const struct tm *tm = localtime (&t);
 
   char s[20];
   strftime (s, sizeof (s) - 1, "%a %b %d", tm);
   int xo = strlen (s) * text_width / 2; 
-  region_draw_bitmap_text (r, font, s, cx - xo, 
-      cy - 2 * text_height, cr, cg, cb); 
+  draw_text (r, font, s, cx - xo, cy - 2 * text_height, cr, cg, cb); 
   }
 
 
@@ -71,21 +238,20 @@ static void draw_date (Region *r, int l, int cx, int cy,
 
 ==========================================================================*/
 static void draw_numerals (Region *r, int l, int cx, int cy, 
-     BYTE cr, BYTE cg, BYTE cb, const BitmapFont *font)
+     BYTE cr, BYTE cg, BYTE cb, const ClockFont *font)
   {
   int text_height = font->height;
   int text_width = font->width;
   for (int i = 0; i < 12; i++)
     {
-    double angle = (double) (i + 1) / 12 * TWOPI;
-    int lx = (l - text_height) * sin (angle);
-    int ly = (l - text_height) * cos (angle);
+    int angle = (i + 1) * TRIG_STEPS / 12;
+    int lx = trig_mul (l - text_height, trig_sin (angle));
+    int ly = trig_mul (l - text_height, trig_cos (angle));
     char s[10];
     sprintf (s, "%d", i + 1); 
     int chrs = (i > 9) ? 2 : 1;
     int xo = chrs * text_width / 2; 
-    region_draw_bitmap_text (r, font, s, cx + lx - xo, 
-      cy - ly, cr, cg, cb); 
+    draw_text (r, font, s, cx + lx - xo, cy - ly, cr, cg, cb); 
     }
   }
 
@@ -95,60 +261,124 @@ static void draw_numerals (Region *r, int l, int cx, int cy,
 
 ==========================================================================*/
 
-const BitmapFont *select_analog_font (int radius)
+static void select_analog_font (int radius, ClockFont *font)
   {
-  if (radius < 80) return &font8;
-  if (radius < 140) return &font12;
-  return &font20;
+  if (radius < 80) 
+    font->font = &font8;
+  else if (radius < 140) 
+    font->font = &font12;
+  else if (radius < SCALED_TEXT_RADIUS) 
+    font->font = &font20;
+  else
+    font->font = &font24;
+  font->width = font->font->width;
+  font->height = font->font->height;
+  if (radius >= SCALED_TEXT_RADIUS)
+    {
+    // In proportion, as font20 is to the smallest clock that uses it
+    font->height = radius / 7;
+    font->width = font->font->width * font->height / font->font->height;
+    }
   }
 
 
 /*==========================================================================
 
-  draw_clock_in_region
+  clock_geometry
+
+  Work out the centre and radius of the clock in a region of a 
+  particular size, and the font that suits it
 
 ==========================================================================*/
-void program_draw_clock_in_region (Region *r, BOOL seconds, BOOL date)
+static void clock_geometry (const Region *r, int *cx, int *cy, int *lm,
+      ClockFont *font)
   {
   int width = region_get_width (r);
   int height = region_get_height (r); 
 
-  time_t t = time (NULL);
-  const struct tm *tm = localtime (&t);
-  int hr = tm->tm_hour;
-  int min = tm->tm_min;
-  int sec = tm->tm_sec;
-
-  BYTE cr = 255, cg = 255, cb = 255;
- 
   // lm is the maximum extent of the drawing area -- the smallest
   //  of the width and height
 
-  int lm;
   if (height < width)
-    lm = height / 2;
+    *lm = height / 2;
   else
-    lm = width / 2;
+    *lm = width / 2;
    
   // cx, cy are the centre of the drawing area
 
-  int cx = width / 2;
-  int cy = height / 2;
+  *cx = width / 2;
+  *cy = height / 2;
+
+  select_analog_font (*lm, font);
+  }
+
 
-  const BitmapFont *font = select_analog_font (lm);
+/*==========================================================================
+
+  program_draw_clock_face
 
-  draw_numerals (r, lm, cx, cy, cr, cg, cb, font);
+  Draw the parts of the clock that don't move -- the numerals, and the
+  date, if it is shown. These only need to be drawn once, on the 
+  background, and again when the background or the date changes
+
+==========================================================================*/
+void program_draw_clock_face (Region *r, const struct tm *tm, BOOL date)
+  {
+  int cx, cy, lm;
+  ClockFont font;
+  clock_geometry (r, &cx, &cy, &lm, &font);
+
+  BYTE cr = 255, cg = 255, cb = 255;
+ 
+  draw_numerals (r, lm, cx, cy, cr, cg, cb, &font);
   if (date)
-    draw_date (r, lm, cx, cy, cr, cg, cb, font);
+    draw_date (r, tm, lm, cx, cy, cr, cg, cb, &font);
+  }
+
+
+/*==========================================================================
+
+  program_draw_clock_hands
 
-  int lm_hands = lm - 2 * font->height;
+  Draw the hands, on a region that already has the clock face. msec is
+  the milliseconds past the second in tm; if it is not zero, the 
+  second hand is drawn that far towards the next second, to the 
+  nearest angle step. A second hand that is between seconds is drawn
+  directly, not from the sprite cache, because when it sweeps there
+  are too many positions for caching to be worthwhile
 
-  if (seconds)
-    draw_hand (r, (double)sec / 60 * TWOPI, cx, cy, 1, 
+==========================================================================*/
+void program_draw_clock_hands (Region *r, const struct tm *tm, 
+      int msec, BOOL seconds)
+  {
+  int cx, cy, lm;
+  ClockFont font;
+  clock_geometry (r, &cx, &cy, &lm, &font);
+
+  int hr = tm->tm_hour;
+  int min = tm->tm_min;
+  int sec = tm->tm_sec;
+
+  BYTE cr = 255, cg = 255, cb = 255;
+
+  // The hands stop at the inner edge of the numerals, which are drawn
+  //   at the height the text is shown at, scaled or not
+  int lm_hands = lm - 2 * font.height;
+
+  // Sprite keys are the position in seconds, minutes, or minutes past
+  //   twelve, plus an offset for each hand
+  if (seconds && msec == 0)
+    draw_hand_cached (r, sec, sec * TRIG_STEPS / 60, cx, cy, 1, 
       lm_hands, cr, cg, cb); // sec
-  draw_hand (r, (double)min / 60 * TWOPI, cx, cy, 5, 
+  else if (seconds)
+    {
+    int angle = ((sec * 1000 + msec) * (TRIG_STEPS / 60) + 500) / 1000;
+    draw_hand (r, angle % TRIG_STEPS, cx, cy, 1, lm_hands, cr, cg, cb);
+    }
+  draw_hand_cached (r, 1000 + min, min * TRIG_STEPS / 60, cx, cy, 5, 
     lm_hands * 9 / 10, cr, cg, cb); // min
-  draw_hand (r, ((double)hr / 12 + (double)min / 60 / 12) * TWOPI, 
+  draw_hand_cached (r, 2000 + hr % 12 * 60 + min, 
+    (hr % 12 * 60 + min) * TRIG_STEPS / 720, 
     cx, cy, 10, lm_hands * 6 / 10, cr, cg, cb); // hour
   }
 
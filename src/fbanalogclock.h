@@ -8,12 +8,17 @@
 
 #pragma once
 
+#include <time.h>
 #include "defs.h"
 #include "region.h"
 
 BEGIN_DECLS
 
-void program_draw_clock_in_region (Region *r, BOOL seconds, BOOL date);
+void program_draw_clock_face (Region *r, const struct tm *tm, BOOL date);
+void program_draw_clock_hands (Region *r, const struct tm *tm, 
+       int msec, BOOL seconds);
+void program_set_hand_cache_budget (long budget);
+void program_free_clock_caches (void);
 
 END_DECLS
 
@@ -10,27 +10,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
-#include <pthread.h>
 #include <stdarg.h>
 #include <errno.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <ctype.h>
-#include <sys/ioctl.h>
 #include <linux/fb.h>
-#include <sys/mman.h>
 #include "string.h" 
 #include "defs.h" 
 #include "log.h" 
 #include "framebuffer.h" 
+#include "blit.h" 
+#include "stats.h" 
+#include "framebuffer_backend.h" 
 
 #define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// When choosing a store kernel, each one writes this many bytes this
+//   many times
+#define PROBE_BYTES 65536
+#define PROBE_PASSES 8
+// Each pass starts up to four bytes further on, and there must be room
+//   for at least one full store after that, or the probe is skipped
+#define PROBE_MIN_BYTES (PROBE_PASSES * 4 + BLIT_STORE_WIDTH)
 
 struct _FrameBuffer
   {
-  int fd;
+  const FrameBufferBackend *backend;
+  void *priv;
   int w;
   int h;
   int fb_data_size;
@@ -40,41 +48,270 @@ struct _FrameBuffer
   int line_length;
   int stride;
   int slop;
+  const BlitKernels *kernels;
+  BlitStoreFn store;
+  struct fb_var_screeninfo vinfo;
+  // Options, set before framebuffer_init
+  BOOL want_page_flip;
+  BOOL want_vsync;
+  // With page flipping there are two pages, one displayed and one 
+  //   being drawn into. Otherwise there is one, and it is both
+  int pages;
+  int page_size;
+  int back;
+  int orig_yoffset;
+  BOOL can_vsync;
+  // The area this program draws in, set by framebuffer_claim_rect
+  int claim_x;
+  int claim_y;
+  int claim_w;
+  int claim_h;
+  // A copy, in ordinary memory, of the claimed area as we last left it.
+  //   Only allocated if something needs it. Reads from the claimed area
+  //   are served from here, since framebuffer memory is usually 
+  //   uncached, and very slow to read
+  BOOL want_shadow;
+  BYTE *shadow;
+  int shadow_stride;
+  // With deferred I/O, only changed words are written, and we count
+  //   the memory pages touched, since each one will be sent to the
+  //   display by the driver
+  BOOL want_deferred_io;
+  int sys_page_size;
+  int n_sys_pages;
+  BYTE *dirty_pages;
+  int frame_pages_dirtied;
+  int64_t frame_bytes_written;
   }; 
 
 
+static BYTE *framebuffer_shadow_ptr (const FrameBuffer *self, 
+      int x, int y, int n);
+
+
 /*==========================================================================
+
   framebuffer_create
+
+  fbdev is normally the name of a framebuffer device. Names that start
+  "mem:" or "file:" select an offscreen framebuffer -- see 
+  framebuffer_offscreen.c for the details
+
 *==========================================================================*/
 FrameBuffer *framebuffer_create (const char *fbdev)
   {
   LOG_IN
   FrameBuffer *self = malloc (sizeof (FrameBuffer));
   self->fbdev = strdup (fbdev);
-  self->fd = -1;
+  if (strncmp (fbdev, "mem:", 4) == 0 || strncmp (fbdev, "file:", 5) == 0)
+    self->backend = &framebuffer_backend_offscreen;
+  else
+    self->backend = &framebuffer_backend_fbdev;
+  self->priv = NULL;
   self->fb_data = NULL;
   self->fb_data_size = 0;
+  self->want_page_flip = FALSE;
+  self->want_vsync = FALSE;
+  self->pages = 1;
+  self->back = 0;
+  self->can_vsync = FALSE;
+  self->claim_w = 0;
+  self->claim_h = 0;
+  self->shadow = NULL;
+  self->want_shadow = FALSE;
+  self->want_deferred_io = FALSE;
+  self->dirty_pages = NULL;
+  self->frame_pages_dirtied = 0;
+  self->frame_bytes_written = 0;
+  int nstores;
+  self->store = blit_get_stores (&nstores)[0].store;
   LOG_OUT 
   return self;
   }
 
 
 /*==========================================================================
+
+  framebuffer_set_shadow
+
+  Keep a copy of the claimed area in ordinary memory, and read from
+  that instead of the framebuffer. Deferred I/O always keeps the copy.
+  This has to be called before framebuffer_claim_rect
+
+*==========================================================================*/
+void framebuffer_set_shadow (FrameBuffer *self, BOOL shadow)
+  {
+  self->want_shadow = shadow;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_set_deferred_io
+
+  Set for framebuffers whose drivers use deferred I/O (fbtft, and many
+  e-paper drivers). These send every memory page that is written to
+  the display, so we keep a shadow copy of what we wrote last time,
+  and only write the words that have changed. Page flipping is not
+  used in this mode. This has to be called before framebuffer_init
+
+*==========================================================================*/
+void framebuffer_set_deferred_io (FrameBuffer *self, BOOL deferred_io)
+  {
+  self->want_deferred_io = deferred_io;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_deferred_io
+
+  Whether the framebuffer is actually being written for deferred I/O, 
+  in which case it can only be written by one thread at a time
+
+*==========================================================================*/
+BOOL framebuffer_get_deferred_io (const FrameBuffer *self)
+  {
+  return self->dirty_pages != NULL;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_set_vsync
+
+  If set, framebuffer_begin_frame waits for the vertical blank, so that
+  the update is not visible half-done. This has to be called before
   framebuffer_init
+
 *==========================================================================*/
-BOOL framebuffer_init (FrameBuffer *self, char **error)
+void framebuffer_set_vsync (FrameBuffer *self, BOOL vsync)
+  {
+  self->want_vsync = vsync;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_set_page_flip
+
+  If set, and the virtual resolution has room for two pages, drawing 
+  goes to the page that is not displayed, and framebuffer_present pans
+  the display to it. Since everything else that draws on the 
+  framebuffer will draw on the first page, this only really makes sense
+  if nothing else is drawing. If page flipping is not possible, we
+  fall back to waiting for vsync. This has to be called before
+  framebuffer_init
+
+*==========================================================================*/
+void framebuffer_set_page_flip (FrameBuffer *self, BOOL flip)
+  {
+  self->want_page_flip = flip;
+  if (flip) self->want_vsync = TRUE;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_setup_flip
+
+  Check that the driver will pan, and make the page we are about to 
+  draw on a copy of the one that is displayed. If panning fails, we
+  go back to a single page
+
+*==========================================================================*/
+static void framebuffer_setup_flip (FrameBuffer *self)
   {
   LOG_IN
-  BOOL ret = FALSE;
-  self->fd = open (self->fbdev, O_RDWR);
-  if (self->fd >= 0)
+  int front = self->vinfo.yoffset / self->h;
+  if (front > 1) front = 0;
+  self->vinfo.yoffset = front * self->h;
+  self->vinfo.xoffset = 0;
+  if (self->backend->pan (self->priv, &self->vinfo) == 0)
+    {
+    self->back = 1 - front;
+    self->store (self->fb_data + self->back * self->page_size, 
+      self->fb_data + front * self->page_size, self->page_size);
+    log_debug ("fb_init: page flipping, drawing on page %d", self->back); 
+    }
+  else
+    {
+    log_warning ("Framebuffer driver can't pan: %s; "
+      "not using page flipping", strerror (errno));
+    self->pages = 1;
+    self->back = front;
+    }
+  LOG_OUT 
+  }
+
+
+/*==========================================================================
+
+  framebuffer_probe_store
+
+  Time each of the available store kernels writing to the framebuffer,
+  and use the fastest. What is written is a copy of what is already 
+  there, so nothing visible happens. Each pass starts at a different
+  pixel offset, because real writes are rarely aligned. This is skipped
+  with deferred I/O, since every page written would be sent to the
+  display, and for a framebuffer too small to time anything on, which 
+  keeps memcpy
+
+*==========================================================================*/
+static void framebuffer_probe_store (FrameBuffer *self)
+  {
+  LOG_IN
+  int count;
+  const BlitStore *stores = blit_get_stores (&count);
+  self->store = stores[0].store;
+  if (count > 1 && !self->want_deferred_io 
+       && self->page_size >= PROBE_MIN_BYTES)
     {
-    struct fb_var_screeninfo vinfo;
-    struct fb_fix_screeninfo finfo;
+    int n = min (PROBE_BYTES, self->page_size) - PROBE_PASSES * 4;
+    BYTE *target = framebuffer_get_data (self);
+    BYTE *copy = malloc (n + PROBE_PASSES * 4);
+    memcpy (copy, target, n + PROBE_PASSES * 4);
+    long best_nsec = -1;
+    for (int i = 0; i < count; i++)
+      {
+      struct timespec start, end;
+      stores[i].store (target, copy, n);
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      for (int pass = 0; pass < PROBE_PASSES; pass++)
+        {
+        int offset = pass * self->fb_bytes;
+        stores[i].store (target + offset, copy + offset, n);
+        }
+      clock_gettime (CLOCK_MONOTONIC, &end);
+      long nsec = (end.tv_sec - start.tv_sec) * 1000000000L 
+        + (end.tv_nsec - start.tv_nsec);
+      if (nsec <= 0) nsec = 1;
+      log_debug ("fb_init: store kernel %s: %ld MB/sec", stores[i].name,
+        (long)((int64_t)n * PROBE_PASSES * 1000 / nsec));
+      if (best_nsec < 0 || nsec < best_nsec)
+        {
+        best_nsec = nsec;
+        self->store = stores[i].store;
+        }
+      }
+    free (copy);
+    }
+  LOG_OUT
+  }
 
-    ioctl (self->fd, FBIOGET_FSCREENINFO, &finfo);
-    ioctl (self->fd, FBIOGET_VSCREENINFO, &vinfo);
 
+/*==========================================================================
+  framebuffer_init
+*==========================================================================*/
+BOOL framebuffer_init (FrameBuffer *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  struct fb_var_screeninfo vinfo;
+  struct fb_fix_screeninfo finfo;
+  if (self->backend->open (&self->priv, self->fbdev, &vinfo, &finfo, error))
+    {
+    log_debug ("fb_init: backend %s", self->backend->name); 
     log_debug ("fb_init: xres %d", vinfo.xres); 
     log_debug ("fb_init: yres %d", vinfo.yres); 
     log_debug ("fb_init: bpp %d",  vinfo.bits_per_pixel); 
@@ -83,22 +320,53 @@ BOOL framebuffer_init (FrameBuffer *self, char **error)
     self->line_length = finfo.line_length; 
     self->w = vinfo.xres;
     self->h = vinfo.yres;
-    int fb_bpp = vinfo.bits_per_pixel;
-    int fb_bytes = fb_bpp / 8;
-    self->fb_bytes = fb_bytes;
-    self->fb_data_size = self->w * self->h * fb_bytes;
+    self->kernels = blit_get_kernels (blit_format_from_screeninfo (&vinfo));
+    self->fb_bytes = self->kernels->bytes_per_pixel;
     self->stride = max (self->line_length, self->w * self->fb_bytes);
     self->slop = self->stride - (self->w * self->fb_bytes);
+    self->vinfo = vinfo;
+    self->orig_yoffset = vinfo.yoffset;
+    self->page_size = self->stride * self->h;
+    self->pages = 1;
+    self->back = 0;
+    if (self->want_page_flip && self->want_deferred_io)
+      log_warning ("Page flipping is not used with deferred I/O");
+    else if (self->want_page_flip)
+      {
+      if (vinfo.yres_virtual >= 2 * vinfo.yres)
+        self->pages = 2;
+      else
+        log_warning ("Virtual resolution %dx%d has no room for a second "
+          "page; not using page flipping", vinfo.xres_virtual, 
+          vinfo.yres_virtual); 
+      }
+    self->fb_data_size = self->page_size * self->pages;
+    self->can_vsync = self->want_vsync;
 
-    self->fb_data = mmap (0, self->fb_data_size, 
-	     PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, (off_t)0);
+    log_debug ("fb_init: pixel format %s", self->kernels->name); 
+    log_debug ("fb_init: yres_virtual %d", vinfo.yres_virtual); 
 
-    ret = TRUE;
-    }
-  else
-    {
-    if (error)
-      asprintf (error, "Can't open framebuffer: %s", strerror (errno));
+    self->fb_data = self->backend->map (self->priv, self->fb_data_size);
+
+    if (self->fb_data)
+      {
+      framebuffer_probe_store (self);
+      if (self->pages == 2)
+        framebuffer_setup_flip (self);
+      if (self->want_deferred_io)
+        {
+        self->sys_page_size = sysconf (_SC_PAGESIZE);
+        self->n_sys_pages = (self->fb_data_size + self->sys_page_size - 1) 
+          / self->sys_page_size;
+        self->dirty_pages = calloc (self->n_sys_pages, 1);
+        }
+      ret = TRUE;
+      }
+    else
+      {
+      if (error)
+        asprintf (error, "Can't map framebuffer: %s", strerror (errno));
+      }
     }
   LOG_OUT 
   return ret;
@@ -113,15 +381,33 @@ void framebuffer_deinit (FrameBuffer *self)
   LOG_IN
   if (self)
     {
-    if (self->fb_data) 
+    if (self->fb_data && self->pages == 2 
+          && self->vinfo.yoffset != self->orig_yoffset)
       {
-      munmap (self->fb_data, self->fb_data_size);
-      self->fb_data = NULL;
+      // Put the display back the way we found it, and make the 
+      //  original page look like the one we were displaying
+      int shown = self->vinfo.yoffset / self->h;
+      int orig = self->orig_yoffset / self->h;
+      self->store (self->fb_data + orig * self->page_size,
+        self->fb_data + shown * self->page_size, self->page_size);
+      self->vinfo.yoffset = self->orig_yoffset;
+      self->backend->pan (self->priv, &self->vinfo);
       }
-    if (self->fd != -1)
+    if (self->shadow)
       {
-      close (self->fd);
-      self->fd = -1;
+      free (self->shadow);
+      self->shadow = NULL;
+      }
+    if (self->dirty_pages)
+      {
+      free (self->dirty_pages);
+      self->dirty_pages = NULL;
+      }
+    if (self->priv)
+      {
+      self->backend->close (self->priv, self->fb_data, self->fb_data_size);
+      self->priv = NULL;
+      self->fb_data = NULL;
       }
     }
   LOG_OUT
@@ -134,13 +420,14 @@ void framebuffer_deinit (FrameBuffer *self)
 void framebuffer_set_pixel (FrameBuffer *self, int x, int y, 
       BYTE r, BYTE g, BYTE b)
   {
-  if (x > 0 && x < self->w && y > 0 && y < self->h)
+  if (x >= 0 && x < self->w && y >= 0 && y < self->h)
     {
-    int index32 = (y * self->w + x) * self->fb_bytes + y * self->slop;
-    self->fb_data [index32++] = b;
-    self->fb_data [index32++] = g;
-    self->fb_data [index32++] = r;
-    self->fb_data [index32] = 0;
+    BYTE bgr[3] = { b, g, r };
+    int index = y * self->stride + x * self->fb_bytes;
+    self->kernels->write_row (framebuffer_get_data (self) + index, bgr, 1);
+    BYTE *shadow = framebuffer_shadow_ptr (self, x, y, self->fb_bytes);
+    if (shadow) 
+      memcpy (shadow, framebuffer_get_data (self) + index, self->fb_bytes);
     }
   }
 
@@ -181,12 +468,14 @@ int framebuffer_get_height (const FrameBuffer *self)
 void framebuffer_get_pixel (const FrameBuffer *self, 
                       int x, int y, BYTE *r, BYTE *g, BYTE *b)
   {
-  if (x > 0 && x < self->w && y > 0 && y < self->h)
+  if (x >= 0 && x < self->w && y >= 0 && y < self->h)
     {
-    int index32 = (y * self->w + x) * self->fb_bytes + (y * self->slop);
-    *b = self->fb_data [index32++];
-    *g = self->fb_data [index32++];
-    *r = self->fb_data [index32];
+    BYTE bgr[3];
+    self->kernels->read_row (bgr, 
+      framebuffer_read_ptr (self, x, y, self->fb_bytes), 1);
+    *b = bgr[0];
+    *g = bgr[1];
+    *r = bgr[2];
     }
   else
     {
@@ -197,11 +486,411 @@ void framebuffer_get_pixel (const FrameBuffer *self,
   }
 
 /*==========================================================================
+
   framebuffer_get_data
+
+  Get the start of the page that should be drawn on. Without page
+  flipping, this is the page that is displayed
+
 *==========================================================================*/
 BYTE *framebuffer_get_data (FrameBuffer *self)
   {
-  return self->fb_data;
+  return self->fb_data + self->back * self->page_size;
+  }
+
+/*==========================================================================
+  framebuffer_get_visible_data
+
+  Get the start of the page that is currently displayed
+*==========================================================================*/
+const BYTE *framebuffer_get_visible_data (const FrameBuffer *self)
+  {
+  int front = self->pages == 2 ? 1 - self->back : self->back;
+  return self->fb_data + front * self->page_size;
+  }
+
+/*==========================================================================
+  framebuffer_get_page_count
+
+  Returns 2 if we are page flipping, so callers know that the page they
+  are drawing on is two frames old, not one
+*==========================================================================*/
+int framebuffer_get_page_count (const FrameBuffer *self)
+  {
+  return self->pages;
+  }
+
+/*==========================================================================
+
+  framebuffer_wait_vsync
+
+  Wait for the next vertical blank, if the driver supports it. If it
+  doesn't, we say so once, and stop asking
+
+*==========================================================================*/
+static void framebuffer_wait_vsync (FrameBuffer *self)
+  {
+  if (self->can_vsync)
+    {
+    if (self->backend->wait_vsync (self->priv) != 0)
+      {
+      log_warning ("Framebuffer driver can't wait for vsync: %s", 
+        strerror (errno));
+      self->can_vsync = FALSE;
+      }
+    }
+  }
+
+/*==========================================================================
+
+  framebuffer_begin_frame
+
+  Call before drawing on the page returned by framebuffer_get_data. 
+  Without page flipping, this waits for the vertical blank (if enabled)
+  so that the drawing happens while the display is not being scanned
+
+*==========================================================================*/
+void framebuffer_begin_frame (FrameBuffer *self)
+  {
+  if (self->pages == 1)
+    framebuffer_wait_vsync (self);
+  if (self->dirty_pages)
+    memset (self->dirty_pages, 0, self->n_sys_pages);
+  self->frame_pages_dirtied = 0;
+  self->frame_bytes_written = 0;
+  }
+
+/*==========================================================================
+
+  framebuffer_present
+
+  Call when drawing is complete. With page flipping, this pans the 
+  display to the page just drawn, and waits for the pan to take effect,
+  so that the other page can safely be drawn on. The totals in the 
+  statistics are for all framebuffers together, but the counts for the
+  last frame are kept for each one, named after its device
+
+*==========================================================================*/
+void framebuffer_present (FrameBuffer *self)
+  {
+  char name[256];
+  stats_add ("fb.frames", 1);
+  snprintf (name, sizeof (name), "fb[%s].frame_bytes_written", 
+    self->fbdev);
+  stats_set (name, self->frame_bytes_written);
+  stats_add ("fb.bytes_written", self->frame_bytes_written);
+  if (self->dirty_pages)
+    {
+    snprintf (name, sizeof (name), "fb[%s].frame_pages_dirtied", 
+      self->fbdev);
+    stats_set (name, self->frame_pages_dirtied);
+    stats_add ("fb.pages_dirtied", self->frame_pages_dirtied);
+    log_debug ("Frame dirtied %d pages", self->frame_pages_dirtied);
+    }
+  if (self->pages == 2)
+    {
+    self->vinfo.yoffset = self->back * self->h;
+    if (self->backend->pan (self->priv, &self->vinfo) == 0)
+      {
+      self->back = 1 - self->back;
+      framebuffer_wait_vsync (self);
+      }
+    else
+      log_warning ("Can't pan framebuffer: %s", strerror (errno));
+    }
+  }
+
+
+
+/*==========================================================================
+  framebuffer_get_stride
+
+  The number of bytes between the starts of successive scanlines
+*==========================================================================*/
+int framebuffer_get_stride (const FrameBuffer *self)
+  {
+  return self->stride;
+  }
+
+/*==========================================================================
+  framebuffer_get_bytes_per_pixel
+*==========================================================================*/
+int framebuffer_get_bytes_per_pixel (const FrameBuffer *self)
+  {
+  return self->fb_bytes;
+  }
+
+/*==========================================================================
+  framebuffer_get_kernels
+
+  The row kernels that convert between Region pixels and this
+  framebuffer's pixel layout
+*==========================================================================*/
+const BlitKernels *framebuffer_get_kernels (const FrameBuffer *self)
+  {
+  return self->kernels;
+  }
+
+/*==========================================================================
+  framebuffer_get_format
+*==========================================================================*/
+PixelFormat framebuffer_get_format (const FrameBuffer *self)
+  {
+  return self->kernels->format;
+  }
+
+/*==========================================================================
+
+  framebuffer_claim_rect
+
+  Tell the framebuffer which area this program draws in. If a shadow
+  copy is wanted, or deferred I/O is in use, this sets up the shadow 
+  copy of that area, with its current contents
+
+*==========================================================================*/
+void framebuffer_claim_rect (FrameBuffer *self, int x, int y, int w, int h)
+  {
+  LOG_IN
+  self->claim_x = x;
+  self->claim_y = y;
+  self->claim_w = w;
+  self->claim_h = h;
+  free (self->shadow);
+  self->shadow = NULL;
+  if (self->want_shadow || self->want_deferred_io)
+    {
+    self->shadow_stride = w * self->fb_bytes;
+    self->shadow = malloc (self->shadow_stride * h);
+    framebuffer_sync_shadow (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  framebuffer_sync_shadow
+
+  Refresh the shadow copy from the framebuffer. This needs to be done
+  when something else has drawn in the claimed area
+
+*==========================================================================*/
+void framebuffer_sync_shadow (FrameBuffer *self)
+  {
+  LOG_IN
+  if (self->shadow)
+    {
+    const BYTE *src = framebuffer_get_visible_data (self) 
+      + self->claim_y * self->stride + self->claim_x * self->fb_bytes;
+    for (int y = 0; y < self->claim_h; y++)
+      {
+      memcpy (self->shadow + y * self->shadow_stride, src, 
+        self->shadow_stride);
+      src += self->stride;
+      }
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  framebuffer_shadow_ptr
+
+  Get the location in the shadow copy corresponding to n bytes starting
+  at (x,y) on the framebuffer, or NULL if there is no shadow, or the
+  span is not entirely in the claimed area
+
+*==========================================================================*/
+static BYTE *framebuffer_shadow_ptr (const FrameBuffer *self, 
+      int x, int y, int n)
+  {
+  if (!self->shadow) return NULL;
+  int sx = (x - self->claim_x) * self->fb_bytes;
+  int sy = y - self->claim_y;
+  if (sx < 0 || sy < 0 || sy >= self->claim_h 
+       || sx + n > self->shadow_stride)
+    return NULL;
+  return self->shadow + sy * self->shadow_stride + sx;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_read_ptr
+
+  Get the location of n bytes of pixel data starting at (x,y) on the
+  page that is displayed. This is in the shadow copy if the span is
+  in the claimed area, and in the framebuffer otherwise
+
+*==========================================================================*/
+const BYTE *framebuffer_read_ptr (const FrameBuffer *self, 
+      int x, int y, int n)
+  {
+  const BYTE *shadow = framebuffer_shadow_ptr (self, x, y, n);
+  if (shadow) return shadow;
+  return framebuffer_get_visible_data (self) 
+    + y * self->stride + x * self->fb_bytes;
+  }
+
+
+// framebuffer_shadow_is_stale checks this many points across, and 
+//   down, the claimed area
+#define STALE_GRID 8
+
+/*==========================================================================
+
+  framebuffer_shadow_is_stale
+
+  Check whether something else has drawn in the claimed area since we
+  last wrote it, by comparing a sparse grid of pixels on the display 
+  with the shadow copy. This is only a few dozen framebuffer reads, so
+  it can be done every frame; but it can miss small changes that fall
+  between the grid points, so a program that changes the background
+  should still say so. Returns FALSE if there is no shadow copy
+
+*==========================================================================*/
+BOOL framebuffer_shadow_is_stale (const FrameBuffer *self)
+  {
+  if (!self->shadow) return FALSE;
+  const BYTE *fb_data = framebuffer_get_visible_data (self);
+  for (int i = 0; i < STALE_GRID; i++)
+    {
+    int y = (2 * i + 1) * self->claim_h / (2 * STALE_GRID);
+    for (int j = 0; j < STALE_GRID; j++)
+      {
+      int x = (2 * j + 1) * self->claim_w / (2 * STALE_GRID);
+      const BYTE *p = fb_data + (self->claim_y + y) * self->stride 
+        + (self->claim_x + x) * self->fb_bytes;
+      if (memcmp (p, self->shadow + y * self->shadow_stride 
+            + x * self->fb_bytes, self->fb_bytes) != 0)
+        {
+        stats_add ("fb.external_changes", 1);
+        return TRUE;
+        }
+      }
+    }
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_mark_dirty
+
+  Count the memory pages touched by writing [dst, dst + n)
+
+*==========================================================================*/
+static void framebuffer_mark_dirty (FrameBuffer *self, 
+      const BYTE *dst, int n)
+  {
+  int first = (dst - self->fb_data) / self->sys_page_size;
+  int last = (dst + n - 1 - self->fb_data) / self->sys_page_size;
+  for (int p = first; p <= last; p++)
+    {
+    if (!self->dirty_pages[p])
+      {
+      self->dirty_pages[p] = 1;
+      self->frame_pages_dirtied++;
+      }
+    }
   }
 
 
+// Unchanged runs shorter than this many bytes are written anyway, if 
+//  that doesn't touch any extra pages, so that we make fewer, longer
+//  writes
+#define DIO_GAP 32
+
+static inline BOOL word_same (const BYTE *a, const BYTE *b, int n)
+  {
+  if (n == 4)
+    {
+    uint32_t wa, wb;
+    memcpy (&wa, a, 4);
+    memcpy (&wb, b, 4);
+    return wa == wb;
+    }
+  return memcmp (a, b, n) == 0;
+  }
+
+/*==========================================================================
+
+  framebuffer_write_changed
+
+  Write only those words of src that differ from the shadow copy. 
+  Changed words that are close together, and in the same page, are
+  written as a single run
+
+*==========================================================================*/
+static void framebuffer_write_changed (FrameBuffer *self, BYTE *dst, 
+      BYTE *shadow, const BYTE *src, int n)
+  {
+  int ps = self->sys_page_size;
+  int i = 0;
+  while (i < n)
+    {
+    int len = n - i < 4 ? n - i : 4;
+    if (word_same (shadow + i, src + i, len))
+      {
+      i += len;
+      continue;
+      }
+
+    int start = i;
+    int end = i + len;
+    int j = end;
+    while (j < n)
+      {
+      len = n - j < 4 ? n - j : 4;
+      if (!word_same (shadow + j, src + j, len))
+        {
+        end = j + len;
+        j = end;
+        }
+      else if (j - end < DIO_GAP
+          && (dst + j - self->fb_data) / ps 
+             == (dst + end - 1 - self->fb_data) / ps)
+        j += len;
+      else
+        break;
+      }
+
+    self->store (dst + start, src + start, end - start);
+    memcpy (shadow + start, src + start, end - start);
+    framebuffer_mark_dirty (self, dst + start, end - start);
+    self->frame_bytes_written += end - start;
+    i = end;
+    }
+  }
+
+
+/*==========================================================================
+
+  framebuffer_write_span
+
+  Write n bytes of pixel data, already in the framebuffer's layout, 
+  starting at (x,y) on the page being drawn. Spans that don't overlap
+  can be written from several threads at once, except with deferred 
+  I/O
+
+*==========================================================================*/
+void framebuffer_write_span (FrameBuffer *self, int x, int y, 
+      const BYTE *src, int n)
+  {
+  BYTE *dst = framebuffer_get_data (self) 
+    + y * self->stride + x * self->fb_bytes;
+  BYTE *shadow = framebuffer_shadow_ptr (self, x, y, n);
+  if (shadow && self->dirty_pages)
+    {
+    framebuffer_write_changed (self, dst, shadow, src, n);
+    }
+  else
+    {
+    self->store (dst, src, n);
+    if (shadow) memcpy (shadow, src, n);
+    if (self->dirty_pages) framebuffer_mark_dirty (self, dst, n);
+    __atomic_fetch_add (&self->frame_bytes_written, n, __ATOMIC_RELAXED);
+    }
+  }
+
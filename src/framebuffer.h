@@ -8,6 +8,7 @@
 #pragma once
 
 #include "defs.h"
+#include "blit.h"
 
 struct _FrameBuffer;
 typedef struct _FrameBuffer FrameBuffer;
@@ -25,5 +26,27 @@ int              framebuffer_get_height (const FrameBuffer *self);
 void             framebuffer_get_pixel (const FrameBuffer *self, 
                       int x, int y, BYTE *r, BYTE *g, BYTE *b);
 BYTE            *framebuffer_get_data (FrameBuffer *self);
+const BYTE      *framebuffer_get_visible_data (const FrameBuffer *self);
+int              framebuffer_get_page_count (const FrameBuffer *self);
+void             framebuffer_set_vsync (FrameBuffer *self, BOOL vsync);
+void             framebuffer_set_page_flip (FrameBuffer *self, BOOL flip);
+void             framebuffer_set_shadow (FrameBuffer *self, BOOL shadow);
+BOOL             framebuffer_get_deferred_io (const FrameBuffer *self);
+void             framebuffer_set_deferred_io (FrameBuffer *self, 
+                      BOOL deferred_io);
+void             framebuffer_claim_rect (FrameBuffer *self, int x, int y, 
+                      int w, int h);
+void             framebuffer_sync_shadow (FrameBuffer *self);
+BOOL             framebuffer_shadow_is_stale (const FrameBuffer *self);
+const BYTE      *framebuffer_read_ptr (const FrameBuffer *self, 
+                      int x, int y, int n);
+void             framebuffer_write_span (FrameBuffer *self, int x, int y,
+                      const BYTE *src, int n);
+void             framebuffer_begin_frame (FrameBuffer *self);
+void             framebuffer_present (FrameBuffer *self);
+int              framebuffer_get_stride (const FrameBuffer *self);
+int              framebuffer_get_bytes_per_pixel (const FrameBuffer *self);
+const BlitKernels *framebuffer_get_kernels (const FrameBuffer *self);
+PixelFormat      framebuffer_get_format (const FrameBuffer *self);
 END_DECLS
 
@@ -0,0 +1,45 @@
+/*============================================================================
+
+  fbclock
+  framebuffer_backend.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  The interface between FrameBuffer and the thing that actually provides
+  the pixel memory. This is only of interest to framebuffer.c and the
+  backend implementations -- everything else uses FrameBuffer.
+
+============================================================================*/
+
+#pragma once
+
+#include <linux/fb.h>
+#include "defs.h"
+
+typedef struct _FrameBufferBackend
+  {
+  const char *name;
+
+  // Open the device described by spec, and fill in the screen
+  //   information, as FBIOGET_VSCREENINFO and FBIOGET_FSCREENINFO would.
+  //   On failure, return FALSE and (if error is not NULL) allocate an
+  //   error message
+  BOOL  (*open) (void **priv, const char *spec,
+           struct fb_var_screeninfo *vinfo,
+           struct fb_fix_screeninfo *finfo, char **error);
+
+  // Map size bytes of pixel memory, starting at the beginning of the
+  //   first page. Return NULL on failure, with errno set
+  BYTE *(*map) (void *priv, int size);
+
+  // The equivalents of FBIOPAN_DISPLAY and FBIO_WAITFORVSYNC. Return 0
+  //   on success, or -1 with errno set
+  int   (*pan) (void *priv, const struct fb_var_screeninfo *vinfo);
+  int   (*wait_vsync) (void *priv);
+
+  // Unmap the memory (if data is not NULL) and release everything
+  void  (*close) (void *priv, BYTE *data, int size);
+  } FrameBufferBackend;
+
+extern const FrameBufferBackend framebuffer_backend_fbdev;
+extern const FrameBufferBackend framebuffer_backend_offscreen;
+
@@ -0,0 +1,126 @@
+/*============================================================================
+
+  fbclock
+  framebuffer_fbdev.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  The FrameBuffer backend for a real Linux framebuffer device, like
+  /dev/fb0.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#include "defs.h"
+#include "log.h"
+#include "framebuffer_backend.h"
+
+typedef struct _FbdevPriv
+  {
+  int fd;
+  } FbdevPriv;
+
+
+/*==========================================================================
+  fbdev_open
+*==========================================================================*/
+static BOOL fbdev_open (void **priv, const char *spec,
+      struct fb_var_screeninfo *vinfo, struct fb_fix_screeninfo *finfo,
+      char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  int fd = open (spec, O_RDWR);
+  if (fd >= 0)
+    {
+    if (ioctl (fd, FBIOGET_FSCREENINFO, finfo) == 0
+         && ioctl (fd, FBIOGET_VSCREENINFO, vinfo) == 0)
+      {
+      FbdevPriv *p = malloc (sizeof (FbdevPriv));
+      p->fd = fd;
+      *priv = p;
+      ret = TRUE;
+      }
+    else
+      {
+      if (error)
+        asprintf (error, "%s is not a framebuffer: %s", spec,
+          strerror (errno));
+      close (fd);
+      }
+    }
+  else
+    {
+    if (error)
+      asprintf (error, "Can't open framebuffer: %s", strerror (errno));
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+  fbdev_map
+*==========================================================================*/
+static BYTE *fbdev_map (void *priv, int size)
+  {
+  FbdevPriv *p = priv;
+  BYTE *data = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    p->fd, (off_t)0);
+  return data == MAP_FAILED ? NULL : data;
+  }
+
+
+/*==========================================================================
+  fbdev_pan
+*==========================================================================*/
+static int fbdev_pan (void *priv, const struct fb_var_screeninfo *vinfo)
+  {
+  FbdevPriv *p = priv;
+  return ioctl (p->fd, FBIOPAN_DISPLAY, vinfo);
+  }
+
+
+/*==========================================================================
+  fbdev_wait_vsync
+*==========================================================================*/
+static int fbdev_wait_vsync (void *priv)
+  {
+  FbdevPriv *p = priv;
+  __u32 crtc = 0;
+  return ioctl (p->fd, FBIO_WAITFORVSYNC, &crtc);
+  }
+
+
+/*==========================================================================
+  fbdev_close
+*==========================================================================*/
+static void fbdev_close (void *priv, BYTE *data, int size)
+  {
+  LOG_IN
+  FbdevPriv *p = priv;
+  if (data) munmap (data, size);
+  close (p->fd);
+  free (p);
+  LOG_OUT
+  }
+
+
+const FrameBufferBackend framebuffer_backend_fbdev =
+  {
+  "fbdev",
+  fbdev_open,
+  fbdev_map,
+  fbdev_pan,
+  fbdev_wait_vsync,
+  fbdev_close
+  };
+
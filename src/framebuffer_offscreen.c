@@ -0,0 +1,227 @@
+/*============================================================================
+
+  fbclock
+  framebuffer_offscreen.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A FrameBuffer backend that is not connected to a display at all. The
+  pixel memory is an anonymous memfd, or a regular file, so the whole
+  rendering process can be run and timed on a machine with no display,
+  and the result inspected afterwards. The device specification looks
+  like one of these:
+
+    mem:WIDTHxHEIGHT[xDEPTH][,LINE_LENGTH]
+    file:WIDTHxHEIGHT[xDEPTH][,LINE_LENGTH]:PATH
+
+  DEPTH is 16, 24 or 32 (the default), or the name of a pixel layout,
+  like BGR565. LINE_LENGTH is in bytes, and defaults to the smallest
+  that will hold a scanline. The virtual height is twice the real
+  height, so that page flipping can be used. Panning and waiting for
+  vsync are emulated: they succeed immediately, and are counted.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#include "defs.h"
+#include "log.h"
+#include "blit.h"
+#include "stats.h"
+#include "framebuffer_backend.h"
+
+typedef struct _OffscreenPriv
+  {
+  int fd;
+  int size;
+  struct fb_var_screeninfo vinfo;
+  } OffscreenPriv;
+
+
+/*==========================================================================
+
+  offscreen_parse_geometry
+
+  Parse WIDTHxHEIGHT[xDEPTH][,LINE_LENGTH] into the screen information.
+  Parsing stops at the end of the string, or a colon; *end is set to
+  the character that stopped it
+
+*==========================================================================*/
+static BOOL offscreen_parse_geometry (const char *s, const char **end,
+      struct fb_var_screeninfo *vinfo, struct fb_fix_screeninfo *finfo)
+  {
+  char *p;
+  int w = strtol (s, &p, 10);
+  if (*p != 'x') return FALSE;
+  int h = strtol (p + 1, &p, 10);
+  if (w <= 0 || h <= 0) return FALSE;
+
+  PixelFormat format = PIXEL_FORMAT_XRGB8888;
+  if (*p == 'x')
+    {
+    char depth[16];
+    int i = 0;
+    p++;
+    while (*p && *p != ',' && *p != ':' && i < sizeof (depth) - 1)
+      depth[i++] = *p++;
+    depth[i] = 0;
+    if (strcmp (depth, "16") == 0)
+      format = PIXEL_FORMAT_RGB565;
+    else if (strcmp (depth, "24") == 0)
+      format = PIXEL_FORMAT_RGB888;
+    else if (strcmp (depth, "32") == 0)
+      format = PIXEL_FORMAT_XRGB8888;
+    else if (!blit_format_from_name (depth, &format))
+      return FALSE;
+    }
+
+  int bytes = blit_get_kernels (format)->bytes_per_pixel;
+  int line_length = w * bytes;
+  if (*p == ',')
+    {
+    line_length = strtol (p + 1, &p, 10);
+    if (line_length < w * bytes) return FALSE;
+    }
+  if (*p != 0 && *p != ':') return FALSE;
+  *end = p;
+
+  memset (vinfo, 0, sizeof (*vinfo));
+  memset (finfo, 0, sizeof (*finfo));
+  vinfo->xres = vinfo->xres_virtual = w;
+  vinfo->yres = h;
+  vinfo->yres_virtual = 2 * h;
+  blit_format_to_screeninfo (format, vinfo);
+  finfo->line_length = line_length;
+  finfo->smem_len = line_length * vinfo->yres_virtual;
+  strncpy (finfo->id, "offscreen", sizeof (finfo->id) - 1);
+  return TRUE;
+  }
+
+
+/*==========================================================================
+  offscreen_open
+*==========================================================================*/
+static BOOL offscreen_open (void **priv, const char *spec,
+      struct fb_var_screeninfo *vinfo, struct fb_fix_screeninfo *finfo,
+      char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  BOOL is_file = strncmp (spec, "file:", 5) == 0;
+  const char *geometry = strchr (spec, ':') + 1;
+  const char *end;
+  if (offscreen_parse_geometry (geometry, &end, vinfo, finfo)
+       && (is_file == (*end == ':')))
+    {
+    int fd;
+    if (is_file)
+      fd = open (end + 1, O_RDWR | O_CREAT, 0644);
+    else
+      fd = memfd_create ("fbclock", 0);
+
+    if (fd >= 0 && ftruncate (fd, finfo->smem_len) == 0)
+      {
+      OffscreenPriv *p = malloc (sizeof (OffscreenPriv));
+      p->fd = fd;
+      p->size = finfo->smem_len;
+      p->vinfo = *vinfo;
+      *priv = p;
+      ret = TRUE;
+      }
+    else
+      {
+      if (error)
+        asprintf (error, "Can't create offscreen framebuffer: %s",
+          strerror (errno));
+      if (fd >= 0) close (fd);
+      }
+    }
+  else
+    {
+    if (error)
+      asprintf (error, "Bad offscreen framebuffer specification: %s", spec);
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+  offscreen_map
+*==========================================================================*/
+static BYTE *offscreen_map (void *priv, int size)
+  {
+  OffscreenPriv *p = priv;
+  if (size > p->size)
+    {
+    errno = EINVAL;
+    return NULL;
+    }
+  BYTE *data = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    p->fd, (off_t)0);
+  return data == MAP_FAILED ? NULL : data;
+  }
+
+
+/*==========================================================================
+
+  offscreen_pan
+
+  Check the new offset the way a driver would, and remember it
+
+*==========================================================================*/
+static int offscreen_pan (void *priv, const struct fb_var_screeninfo *vinfo)
+  {
+  OffscreenPriv *p = priv;
+  if (vinfo->xoffset != 0
+       || vinfo->yoffset + p->vinfo.yres > p->vinfo.yres_virtual)
+    {
+    errno = EINVAL;
+    return -1;
+    }
+  p->vinfo.yoffset = vinfo->yoffset;
+  stats_add ("offscreen.pans", 1);
+  return 0;
+  }
+
+
+/*==========================================================================
+  offscreen_wait_vsync
+*==========================================================================*/
+static int offscreen_wait_vsync (void *priv)
+  {
+  stats_add ("offscreen.vsyncs", 1);
+  return 0;
+  }
+
+
+/*==========================================================================
+  offscreen_close
+*==========================================================================*/
+static void offscreen_close (void *priv, BYTE *data, int size)
+  {
+  LOG_IN
+  OffscreenPriv *p = priv;
+  if (data) munmap (data, size);
+  close (p->fd);
+  free (p);
+  LOG_OUT
+  }
+
+
+const FrameBufferBackend framebuffer_backend_offscreen =
+  {
+  "offscreen",
+  offscreen_open,
+  offscreen_map,
+  offscreen_pan,
+  offscreen_wait_vsync,
+  offscreen_close
+  };
+
@@ -0,0 +1,274 @@
+/*============================================================================
+
+  fbclock
+  framescheduler.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Paces the frames of an animation at a fixed rate. Each frame is due
+  at a fixed deadline on the monotonic clock, and the deadlines are a
+  whole number of frame periods apart, so the rate doesn't drift by
+  the time it takes to draw. If a frame takes so long that the next
+  deadline has already passed, the frames that should have been drawn
+  meanwhile are dropped, and the next frame is due at the first 
+  deadline still to come.
+
+  The deadlines are placed so that, on the wall clock, they fall on
+  multiples of the frame period after each second. A hand that moves
+  in steps of one frame then lands on the same positions every second,
+  however long the drawing takes. If the wall clock is set, the
+  deadlines are moved to match.
+
+  The scheduler doesn't wait itself: it arms a timerfd on the 
+  monotonic clock for each deadline, which the program's event loop
+  waits on, along with everything else.
+
+  Once a second, the achieved frame rate, the CPU time used (by all
+  threads, as a percentage of one core) and the longest frame are
+  logged at debug level, and stored in the statistics.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include "defs.h"
+#include "log.h"
+#include "stats.h"
+#include "framescheduler.h"
+
+#define NSEC 1000000000LL
+
+// If the wall clock moves this far against the monotonic clock, in
+//   nanoseconds, the deadlines are moved to match
+#define REALIGN_NSEC 2000000LL
+
+struct _FrameScheduler
+  {
+  int fd;
+  // All times in nanoseconds. Deadlines are on the monotonic clock;
+  //   offset is what to add to convert them to the wall clock
+  int64_t period;
+  int64_t next;
+  int64_t offset;
+  int64_t woke;
+  // The frames since the statistics were last worked out
+  int64_t window_start;
+  int64_t window_cpu;
+  int window_frames;
+  int window_dropped;
+  int64_t window_longest;
+  };
+
+
+/*==========================================================================
+  frame_scheduler_now
+*==========================================================================*/
+static int64_t frame_scheduler_now (clockid_t clock)
+  {
+  struct timespec ts;
+  clock_gettime (clock, &ts);
+  return ts.tv_sec * NSEC + ts.tv_nsec;
+  }
+
+
+/*==========================================================================
+
+  frame_scheduler_align
+
+  Set the deadline of the frame being drawn so that the next one falls
+  on a multiple of the period after a wall clock second. mono and real
+  are the current times on the two clocks
+
+*==========================================================================*/
+static void frame_scheduler_align (FrameScheduler *self, int64_t mono,
+      int64_t real)
+  {
+  int64_t second = real - real % NSEC;
+  int64_t frame = (real % NSEC) / self->period + 1;
+  int64_t due = second + frame * self->period;
+  if (due > second + NSEC) due = second + NSEC;
+  self->offset = real - mono;
+  self->next = due - self->offset - self->period;
+  }
+
+
+/*==========================================================================
+
+  frame_scheduler_update_stats
+
+  Work out the frame rate and CPU use, if it is a second since that was
+  last done. Times are measured from the start of one frame to the 
+  start of another, which are steadier than the ends
+
+*==========================================================================*/
+static void frame_scheduler_update_stats (FrameScheduler *self)
+  {
+  int64_t elapsed = self->woke - self->window_start;
+  if (elapsed < NSEC) return;
+  int64_t cpu = frame_scheduler_now (CLOCK_PROCESS_CPUTIME_ID);
+  double fps = self->window_frames * (double)NSEC / elapsed;
+  double load = (cpu - self->window_cpu) * 100.0 / elapsed;
+  log_debug ("Sweep: %.1f fps, %.1f%% CPU, %d frames dropped, "
+    "longest frame %ld usec", fps, load, self->window_dropped,
+    (long)(self->window_longest / 1000));
+  stats_set ("sweep.fps", (int64_t)(fps + 0.5));
+  stats_set ("sweep.cpu_percent", (int64_t)(load + 0.5));
+  stats_set ("sweep.longest_frame_usec", self->window_longest / 1000);
+  self->window_start = self->woke;
+  self->window_cpu = cpu;
+  self->window_frames = 0;
+  self->window_dropped = 0;
+  self->window_longest = 0;
+  }
+
+
+/*==========================================================================
+
+  frame_scheduler_create
+
+  Create a scheduler for fps frames a second. The first frame is due
+  immediately. Returns NULL, having logged the reason, if the timer 
+  can't be made
+
+*==========================================================================*/
+FrameScheduler *frame_scheduler_create (int fps)
+  {
+  LOG_IN
+  FrameScheduler *self = NULL;
+  int fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd >= 0)
+    {
+    self = malloc (sizeof (FrameScheduler));
+    self->fd = fd;
+    if (fps < 1) fps = 1;
+    self->period = NSEC / fps;
+    int64_t mono = frame_scheduler_now (CLOCK_MONOTONIC);
+    frame_scheduler_align (self, mono, 
+      frame_scheduler_now (CLOCK_REALTIME));
+    self->woke = mono;
+    self->window_start = mono;
+    self->window_cpu = frame_scheduler_now (CLOCK_PROCESS_CPUTIME_ID);
+    self->window_frames = 0;
+    self->window_dropped = 0;
+    self->window_longest = 0;
+    }
+  else
+    log_error ("Can't create frame timer: %s", strerror (errno));
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  frame_scheduler_destroy
+*==========================================================================*/
+void frame_scheduler_destroy (FrameScheduler *self)
+  {
+  LOG_IN
+  close (self->fd);
+  free (self);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  frame_scheduler_get_fd
+
+  The timer, which becomes readable when the next frame is due
+
+*==========================================================================*/
+int frame_scheduler_get_fd (const FrameScheduler *self)
+  {
+  return self->fd;
+  }
+
+
+/*==========================================================================
+
+  frame_scheduler_frame_done
+
+  Call this when a frame has been drawn. Arms the timer for the next 
+  frame, dropping frames if it is already too late for them
+
+*==========================================================================*/
+void frame_scheduler_frame_done (FrameScheduler *self)
+  {
+  int64_t mono = frame_scheduler_now (CLOCK_MONOTONIC);
+  int64_t cost = mono - self->woke;
+  if (cost > self->window_longest) self->window_longest = cost;
+  self->window_frames++;
+  stats_add ("sweep.frames", 1);
+
+  self->next += self->period;
+  if (mono >= self->next)
+    {
+    int64_t missed = (mono - self->next) / self->period + 1;
+    self->next += missed * self->period;
+    self->window_dropped += missed;
+    stats_add ("sweep.dropped", missed);
+    }
+  frame_scheduler_update_stats (self);
+
+  struct itimerspec its;
+  memset (&its, 0, sizeof (its));
+  its.it_value.tv_sec = self->next / NSEC;
+  its.it_value.tv_nsec = self->next % NSEC;
+  timerfd_settime (self->fd, TFD_TIMER_ABSTIME, &its, NULL);
+  }
+
+
+/*==========================================================================
+
+  frame_scheduler_get_due
+
+  The wall clock time that the next frame should show, once 
+  frame_scheduler_frame_done has worked out which frame that is
+
+*==========================================================================*/
+void frame_scheduler_get_due (const FrameScheduler *self, 
+      struct timespec *when)
+  {
+  int64_t due = self->next + self->offset;
+  when->tv_sec = due / NSEC;
+  when->tv_nsec = due % NSEC;
+  }
+
+
+/*==========================================================================
+
+  frame_scheduler_expired
+
+  Call this when the timer is readable. Returns TRUE, and sets when to
+  the wall clock time that the frame should show, if a frame is due
+
+*==========================================================================*/
+BOOL frame_scheduler_expired (FrameScheduler *self, struct timespec *when)
+  {
+  uint64_t expirations;
+  if (read (self->fd, &expirations, sizeof (expirations)) 
+        != sizeof (expirations))
+    return FALSE;
+
+  int64_t mono = frame_scheduler_now (CLOCK_MONOTONIC);
+  int64_t real = frame_scheduler_now (CLOCK_REALTIME);
+  int64_t due = self->next + self->offset;
+  int64_t shift = real - mono - self->offset;
+  if (shift > REALIGN_NSEC || shift < -REALIGN_NSEC)
+    {
+    log_debug ("Wall clock moved by %ld usec; realigning frames",
+      (long)(shift / 1000));
+    frame_scheduler_align (self, mono, real);
+    due = real;
+    }
+  self->woke = mono;
+  when->tv_sec = due / NSEC;
+  when->tv_nsec = due % NSEC;
+  return TRUE;
+  }
+
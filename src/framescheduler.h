@@ -0,0 +1,29 @@
+/*============================================================================
+
+  fbclock
+  framescheduler.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <time.h>
+#include "defs.h"
+
+struct _FrameScheduler;
+typedef struct _FrameScheduler FrameScheduler;
+
+BEGIN_DECLS
+
+FrameScheduler *frame_scheduler_create (int fps);
+void            frame_scheduler_destroy (FrameScheduler *self);
+int             frame_scheduler_get_fd (const FrameScheduler *self);
+void            frame_scheduler_frame_done (FrameScheduler *self);
+void            frame_scheduler_get_due (const FrameScheduler *self,
+                   struct timespec *when);
+BOOL            frame_scheduler_expired (FrameScheduler *self,
+                   struct timespec *when);
+
+END_DECLS
+
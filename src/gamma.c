@@ -0,0 +1,58 @@
+/*============================================================================
+
+  fbclock
+  gamma.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Conversion between sRGB values, which is what the framebuffer holds,
+  and linear light intensities, which is what has to be mixed when a
+  pixel is partly covered by a shape. Mixing sRGB values directly makes
+  the edges of light shapes on a dark background too dark, and the 
+  edges of dark shapes too light, so that an anti-aliased line looks
+  thinner at some angles than at others.
+
+  Both directions are lookup tables. sRGB to linear has an entry for
+  each of the 256 sRGB values; linear to sRGB has an entry for each 
+  linear value, because a table indexed by only the top eight bits
+  of the linear value would lose most of the dark sRGB values. The
+  tables are built by gamma_init, which is the only time libm is 
+  called, and convert every sRGB value to linear and back exactly.
+
+============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "defs.h"
+#include "gamma.h"
+
+uint16_t gamma_to_linear[256];
+BYTE gamma_to_srgb[GAMMA_LINEAR_MAX + 1];
+static BOOL tables_built = FALSE;
+
+
+/*==========================================================================
+  gamma_init
+
+  Build the tables, if they have not been built already. This must be
+  called before gamma_blend is used
+*==========================================================================*/
+void gamma_init (void)
+  {
+  if (tables_built) return;
+  for (int i = 0; i < 256; i++)
+    {
+    double s = i / 255.0;
+    double l = s <= 0.04045 ? s / 12.92 : pow ((s + 0.055) / 1.055, 2.4);
+    gamma_to_linear[i] = (uint16_t) lround (l * GAMMA_LINEAR_MAX);
+    }
+  for (int i = 0; i <= GAMMA_LINEAR_MAX; i++)
+    {
+    double l = (double) i / GAMMA_LINEAR_MAX;
+    double s = l <= 0.0031308 ? l * 12.92 
+      : 1.055 * pow (l, 1 / 2.4) - 0.055;
+    gamma_to_srgb[i] = (BYTE) lround (s * 255);
+    }
+  tables_built = TRUE;
+  }
+
@@ -0,0 +1,39 @@
+/*============================================================================
+
+  fbclock
+  gamma.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+// Linear light intensities have this many bits. Twelve are enough that
+//   every sRGB value has a distinct linear value, even at the dark end,
+//   where the sRGB curve is steepest
+#define GAMMA_LINEAR_BITS 12
+#define GAMMA_LINEAR_MAX ((1 << GAMMA_LINEAR_BITS) - 1)
+
+BEGIN_DECLS
+
+extern uint16_t gamma_to_linear[256];
+extern BYTE     gamma_to_srgb[GAMMA_LINEAR_MAX + 1];
+
+void     gamma_init (void);
+
+END_DECLS
+
+/*==========================================================================
+  gamma_blend
+
+  Mix sRGB values c and p in the proportions a:255-a, in linear light,
+  rounding to nearest
+*==========================================================================*/
+static inline BYTE gamma_blend (int c, int p, int a)
+  {
+  int l = gamma_to_linear[c] * a + gamma_to_linear[p] * (255 - a) + 127;
+  return gamma_to_srgb[l / 255];
+  }
+
@@ -0,0 +1,372 @@
+/*============================================================================
+
+  fbclock
+  microbench.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Times single drawing operations, rather than whole frames, for
+  --benchmark-op. Each operation is run n times, on a region the size
+  of the clock, in the pixel format of the first output, and the
+  results are logged at info level. Random input comes from a fixed
+  seed, so that runs can be compared.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "defs.h"
+#include "log.h"
+#include "framebuffer.h"
+#include "region.h"
+#include "bitmap_font.h"
+#include "textcache.h"
+#include "microbench.h"
+
+#define MICROBENCH_SEED 12345
+#define MICROBENCH_TEXT "Mon 12 Oct 2020 10:42"
+// As LINE_BAND in region.c, so that the reference line records its
+//   damage in the same way as the real one
+#define MICROBENCH_LINE_BAND 16
+
+
+/*==========================================================================
+  microbench_now
+*==========================================================================*/
+static int64_t microbench_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+
+/*==========================================================================
+
+  microbench_random
+
+  A number from lo to hi - 1, from a linear congruential generator,
+  which is the same on every platform, unlike rand()
+
+*==========================================================================*/
+static int microbench_random (uint32_t *seed, int lo, int hi)
+  {
+  *seed = *seed * 1103515245 + 12345;
+  return lo + (int)((*seed >> 8) % (uint32_t)(hi - lo));
+  }
+
+
+/*==========================================================================
+
+  microbench_ref_pixel
+
+  Set a pixel to the colour scaled by t, as the float line did. The 
+  colour is written over the pixel, not blended with it
+
+*==========================================================================*/
+static void microbench_ref_pixel (Region *r, int x, int y, 
+      BYTE cr, BYTE cg, BYTE cb, float t)
+  {
+  region_set_pixel (r, x, y, (BYTE)(t * cr), (BYTE)(t * cg), 
+    (BYTE)(t * cb));
+  }
+
+
+/*==========================================================================
+
+  microbench_ref_plot
+
+  Plot a pixel of the float line, whose coordinates are swapped if it
+  is steep
+
+*==========================================================================*/
+static inline void microbench_ref_plot (Region *r, BOOL steep, int x, 
+      int y, BYTE cr, BYTE cg, BYTE cb, float t)
+  {
+  if (steep)
+    microbench_ref_pixel (r, y, x, cr, cg, cb, t);
+  else
+    microbench_ref_pixel (r, x, y, cr, cg, cb, t);
+  }
+
+
+/*==========================================================================
+
+  microbench_ref_line
+
+  The Wu line as it was drawn before it was done in fixed point, kept
+  as a reference to time the real one against: floating point, with
+  floor() at every step, and every pixel bounds-checked, instead of
+  the line being clipped first. Its damage is recorded in bands, as
+  the real one's is
+
+*==========================================================================*/
+static void microbench_ref_line (Region *r, int x0, int y0, 
+      int x1, int y1, BYTE cr, BYTE cg, BYTE cb)
+  {
+  int ddx = x1 - x0;
+  int ddy = y1 - y0;
+  int steps = abs (ddx) > abs (ddy) ? abs (ddx) : abs (ddy);
+  int bands = steps / MICROBENCH_LINE_BAND + 1;
+  for (int i = 0; i < bands; i++)
+    {
+    int ax = x0 + ddx * i / bands;
+    int ay = y0 + ddy * i / bands;
+    int bx = x0 + ddx * (i + 1) / bands;
+    int by = y0 + ddy * (i + 1) / bands;
+    region_add_damage (r, (ax < bx ? ax : bx) - 1, (ay < by ? ay : by) - 1,
+      (ax > bx ? ax : bx) + 2, (ay > by ? ay : by) + 2);
+    }
+
+  BOOL steep = abs (y1 - y0) > abs (x1 - x0);
+  int t;
+  if (steep)
+    {
+    t = x0; x0 = y0; y0 = t;
+    t = x1; x1 = y1; y1 = t;
+    }
+  if (x0 > x1)
+    {
+    t = x0; x0 = x1; x1 = t;
+    t = y0; y0 = y1; y1 = t;
+    }
+
+  float dx = x1 - x0;
+  float dy = y1 - y0;
+  float gradient = dx == 0.0 ? 1 : dy / dx;
+
+  // The end points are whole pixels, so the gaps are all 0.5
+  float yend = y0;
+  float xgap = 0.5;
+  int xpxl1 = x0;
+  int ypxl1 = floor (yend);
+  float f = yend - floor (yend);
+  microbench_ref_plot (r, steep, xpxl1, ypxl1, cr, cg, cb, (1 - f) * xgap);
+  microbench_ref_plot (r, steep, xpxl1, ypxl1 + 1, cr, cg, cb, f * xgap);
+  float intersect = yend + gradient;
+
+  yend = y1;
+  int xpxl2 = x1;
+  int ypxl2 = floor (yend);
+  f = yend - floor (yend);
+  microbench_ref_plot (r, steep, xpxl2, ypxl2, cr, cg, cb, (1 - f) * xgap);
+  microbench_ref_plot (r, steep, xpxl2, ypxl2 + 1, cr, cg, cb, f * xgap);
+
+  for (int x = xpxl1; x <= xpxl2; x++)
+    {
+    float fl = floor (intersect);
+    f = intersect - fl;
+    microbench_ref_plot (r, steep, x, fl, cr, cg, cb, 1 - f);
+    microbench_ref_plot (r, steep, x, fl + 1, cr, cg, cb, f);
+    intersect += gradient;
+    }
+  }
+
+
+/*==========================================================================
+
+  microbench_lines_pass
+
+  Draw the same n random lines on the region with the real line, and
+  then with the float reference, with end points from x0,y0 to x1,y1,
+  and log the time per line and per step along the major axis of the
+  whole line, including the part clipped off. The end points are made
+  before the timing starts
+
+*==========================================================================*/
+static void microbench_lines_pass (Region *r, int n, const char *what,
+      int x0, int y0, int x1, int y1)
+  {
+  uint32_t seed = MICROBENCH_SEED;
+  int *points = malloc (n * 4 * sizeof (int));
+  int64_t steps = 0;
+  for (int i = 0; i < n; i++)
+    {
+    int *p = points + i * 4;
+    p[0] = microbench_random (&seed, x0, x1);
+    p[1] = microbench_random (&seed, y0, y1);
+    p[2] = microbench_random (&seed, x0, x1);
+    p[3] = microbench_random (&seed, y0, y1);
+    int dx = abs (p[2] - p[0]);
+    int dy = abs (p[3] - p[1]);
+    steps += (dx > dy ? dx : dy) + 1;
+    }
+
+  for (int pass = 0; pass < 2; pass++)
+    {
+    int64_t start = microbench_now ();
+    for (int i = 0; i < n; i++)
+      {
+      const int *p = points + i * 4;
+      if (pass == 0)
+        region_draw_line_one_pixel (r, p[0], p[1], p[2], p[3], 
+          255, 255, 255);
+      else
+        microbench_ref_line (r, p[0], p[1], p[2], p[3], 255, 255, 255);
+      }
+    int64_t nsec = microbench_now () - start;
+
+    log_info ("Benchmark lines %s, %s: %d in %ld usec, %ld nsec per line, "
+      "%.2f nsec per step", what, pass == 0 ? "fixed point" : "float", 
+      n, (long)(nsec / 1000), (long)(nsec / n), (double)nsec / steps);
+    }
+  free (points);
+  }
+
+
+/*==========================================================================
+
+  microbench_lines
+
+  Random lines with both ends inside the region, and then with ends
+  anywhere in a box twice its size, around it, so that most are
+  clipped. Each set is drawn with the fixed-point line and then with
+  the float line it replaced. The fixed-point line is clipped once, 
+  before it is drawn, so for it clipped lines should take less time 
+  per step of the whole line than lines inside; the float line checks
+  every pixel, so for it they take about the same. The damage 
+  bookkeeping is included in the times
+
+*==========================================================================*/
+static void microbench_lines (Region *r, int n)
+  {
+  int w = region_get_width (r);
+  int h = region_get_height (r);
+  microbench_lines_pass (r, n, "inside", 0, 0, w, h);
+  microbench_lines_pass (r, n, "clipped", -w / 2, -h / 2,
+    w + w / 2, h + h / 2);
+  }
+
+
+/*==========================================================================
+
+  microbench_ref_from_fb
+
+  Capture the area under the clock a pixel at a time, with 
+  framebuffer_get_pixel, as region_from_fb did before it copied whole
+  scanlines. Kept as a reference to time the real one against
+
+*==========================================================================*/
+static void microbench_ref_from_fb (Region *r, const FrameBuffer *fb, 
+      int x1, int y1)
+  {
+  int w = region_get_width (r);
+  int h = region_get_height (r);
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+      {
+      BYTE cr, cg, cb;
+      framebuffer_get_pixel (fb, x + x1, y + y1, &cr, &cg, &cb);
+      region_set_pixel (r, x, y, cr, cg, cb);
+      }
+  }
+
+
+/*==========================================================================
+
+  microbench_resample
+
+  Capture the area under the clock from the framebuffer, as is done
+  when the background is resampled, first with region_from_fb, and then
+  with the per-pixel reference
+
+*==========================================================================*/
+static void microbench_resample (Region *r, const FrameBuffer *fb, 
+      int n, int x, int y)
+  {
+  for (int pass = 0; pass < 2; pass++)
+    {
+    int64_t start = microbench_now ();
+    for (int i = 0; i < n; i++)
+      {
+      if (pass == 0)
+        region_from_fb (r, fb, x, y);
+      else
+        microbench_ref_from_fb (r, fb, x, y);
+      }
+    int64_t nsec = microbench_now () - start;
+    log_info ("Benchmark resample, %s: %d in %ld usec, %ld usec per "
+      "capture of %dx%d", pass == 0 ? "scanlines" : "per pixel", n, 
+      (long)(nsec / 1000), (long)(nsec / 1000 / n), 
+      region_get_width (r), region_get_height (r));
+    }
+  }
+
+
+/*==========================================================================
+
+  microbench_glyphs
+
+  Draw a 21-character string in each of the bitmap fonts, and log the
+  glyphs drawn per millisecond. The text cache is turned off, so that
+  the glyphs themselves are drawn. The string is moved across a few
+  columns, so that it doesn't always start at the same alignment. It
+  is drawn on a region of its own, wide enough that it is never 
+  clipped, whatever the size of the clock
+
+*==========================================================================*/
+static void microbench_glyphs (const FrameBuffer *fb, int n)
+  {
+  static const struct { const BitmapFont *bf; const char *name; } fonts[] =
+    {
+      { &font8, "font8" },
+      { &font12, "font12" },
+      { &font16, "font16" },
+      { &font20, "font20" },
+      { &font24, "font24" },
+    };
+  int glyphs = strlen (MICROBENCH_TEXT);
+  Region *r = region_create_for_fb (fb, glyphs * font24.width + 8,
+    font24.height);
+  text_cache_set_budget (0);
+  for (int f = 0; f < sizeof (fonts) / sizeof (fonts[0]); f++)
+    {
+    int64_t start = microbench_now ();
+    for (int i = 0; i < n; i++)
+      region_draw_bitmap_text (r, fonts[f].bf, MICROBENCH_TEXT,
+        i % 8, 0, 255, 255, 255);
+    int64_t nsec = microbench_now () - start;
+    if (nsec < 1) nsec = 1;
+    log_info ("Benchmark glyphs %s: %d in %ld usec, %ld glyphs per msec",
+      fonts[f].name, n * glyphs, (long)(nsec / 1000), 
+      (long)((int64_t)n * glyphs * 1000000 / nsec));
+    }
+  region_destroy (r);
+  }
+
+
+/*==========================================================================
+
+  microbench_run
+
+  Run the operation op n times. x, y, w and h are the position and
+  size of the clock on the framebuffer. Returns FALSE, having logged
+  the reason, if op is not known
+
+*==========================================================================*/
+BOOL microbench_run (const char *op, int n, FrameBuffer *fb,
+      int x, int y, int w, int h)
+  {
+  LOG_IN
+  BOOL ret = TRUE;
+  if (n < 1) n = 1;
+  Region *r = region_create_for_fb (fb, w, h);
+  if (strcmp (op, "lines") == 0)
+    microbench_lines (r, n);
+  else if (strcmp (op, "resample") == 0)
+    microbench_resample (r, fb, n, x, y);
+  else if (strcmp (op, "glyphs") == 0)
+    microbench_glyphs (fb, n);
+  else
+    {
+    log_error ("Unknown benchmark operation: %s", op);
+    ret = FALSE;
+    }
+  region_destroy (r);
+  LOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,20 @@
+/*============================================================================
+
+  fbclock
+  microbench.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "framebuffer.h"
+
+BEGIN_DECLS
+
+BOOL microbench_run (const char *op, int n, FrameBuffer *fb,
+       int x, int y, int w, int h);
+
+END_DECLS
+
@@ -15,8 +15,12 @@
 #include <string.h>
 #include <getopt.h>
 #include <time.h>
+#include <errno.h>
 #include <signal.h>
 #include <math.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include "program_context.h" 
 #include "feature.h" 
 #include "program.h" 
@@ -27,69 +31,276 @@
 #include "framebuffer.h"
 #include "region.h"
 #include "fbanalogclock.h"
+#include "stats.h"
+#include "textcache.h"
+#include "workpool.h"
+#include "framescheduler.h"
+#include "ticktimer.h"
+#include "tzcache.h"
+#include "microbench.h"
 
 #define DEF_WIDTH 300
 #define DEF_HEIGHT 300
 #define DEF_POSITION_X 20 
 #define DEF_POSITION_Y 20 
 #define DEF_TRANSPARENCY 50
+// Kilobytes of hand sprites to cache, for each size of clock
+#define DEF_HAND_CACHE 4096
+// Kilobytes of rendered labels to cache, for all clocks together
+#define DEF_TEXT_CACHE 64
+// Times to run an operation with --benchmark-op, if --benchmark 
+//   doesn't say
+#define DEF_BENCHMARK_OPS 10000
+
+
+// One display that the clock is drawn on. Most settings can be given 
+//   separately for each output -- see program_get_output_integer
+typedef struct _Output
+  {
+  FrameBuffer *fb;
+  const char *fbdev;
+  int x;
+  int y;
+  int width;
+  int height;
+  int transparency;
+  // The darkened sample of the framebuffer under the clock
+  Region *wallpaper;
+  // The wallpaper with the parts of the clock that don't move drawn on
+  //   it, and the day it was drawn for, if it shows the date
+  Region *base;
+  int base_day;
+  // The frame persists from one tick to the next. Each tick we
+  //   revert whatever was drawn on it last time, and draw the clock
+  //   again, so only the areas that were touched get written to
+  //   the framebuffer
+  Region *frame;
+  // Set when the background has been resampled, so the base has to be
+  //   redrawn, and the whole clock area rewritten, not just the parts 
+  //   that changed
+  BOOL background_changed;
+  } Output;
+
+static Output *outputs = NULL;
+static int n_outputs = 0;
+// The threads that draw the frames, shared by all outputs. NULL unless
+//   --threads asks for more than one
+static WorkPool *pool = NULL;
+
+// The most events handled by one call to epoll_wait
+#define MAX_EVENTS 8
+
+/*==========================================================================
+
+  program_resample_background
+
+  Sample the framebuffer under the clock, and darken it to form the
+  background on which the clock is drawn. The time taken is logged,
+  because this is the most expensive thing we do
+
+==========================================================================*/
+static void program_resample_background (Output *output)
+  {
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  framebuffer_sync_shadow (output->fb);
+  region_from_fb (output->wallpaper, output->fb, output->x, output->y);
+  region_darken (output->wallpaper, output->transparency);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  log_debug ("%s: background resampled in %ld usec", output->fbdev,
+    (end.tv_sec - start.tv_sec) * 1000000 
+      + (end.tv_nsec - start.tv_nsec) / 1000);
+  stats_add ("clock.resamples", 1);
+  output->background_changed = TRUE;
+  }
+
+
+/*==========================================================================
+
+  program_handle_signals
+
+  Read the signals that have arrived from the signalfd, and do what
+  they ask. USR1 logs the statistics. USR2 means that the background 
+  has been redrawn, so we must redraw also, using the new background:
+  all the outputs are sampled again, since we don't know which was 
+  redrawn. However many USR2s have arrived, this is done once. Returns
+  TRUE if the backgrounds were resampled. TERM, INT and HUP set *quit,
+  so that the main loop ends, and the framebuffers are put back as 
+  they were -- with --page-flip, the display is panned back to the 
+  page the console draws on.
+
+  Because this is called from the main loop, and not from a signal 
+  handler, the backgrounds can't change while a frame is being drawn
+
+==========================================================================*/
+static BOOL program_handle_signals (int sfd, BOOL *quit)
+  {
+  BOOL usr1 = FALSE, usr2 = FALSE;
+  struct signalfd_siginfo si;
+  while (read (sfd, &si, sizeof (si)) == sizeof (si))
+    {
+    if (si.ssi_signo == SIGUSR1)
+      usr1 = TRUE;
+    else if (si.ssi_signo == SIGUSR2)
+      {
+      usr2 = TRUE;
+      stats_add ("clock.usr2_signals", 1);
+      }
+    else
+      {
+      log_info ("Stopping on signal %d", (int)si.ssi_signo);
+      *quit = TRUE;
+      }
+    }
+
+  if (usr2)
+    {
+    for (int i = 0; i < n_outputs; i++)
+      program_resample_background (&outputs[i]);
+    }
+  if (usr1) stats_log ();
+  return usr2;
+  }
+
+
+/*==========================================================================
+
+  program_wait
+
+  Wait for something to happen: the next tick or frame to be due, a
+  signal, or the time zone to change. Returns TRUE, with now set to 
+  the time to show, if the clock should be drawn. Sets *quit if a 
+  signal asks the program to stop. scheduler is NULL unless the second
+  hand sweeps, in which case timer is NULL
+
+==========================================================================*/
+static BOOL program_wait (int epfd, int sfd, int tzfd, 
+      FrameScheduler *scheduler, TickTimer *timer, struct timespec *now,
+      BOOL *quit)
+  {
+  struct epoll_event events[MAX_EVENTS];
+  int n = epoll_wait (epfd, events, MAX_EVENTS, -1);
+  BOOL draw = FALSE;
+  for (int i = 0; i < n; i++)
+    {
+    int fd = events[i].data.fd;
+    if (fd == sfd)
+      {
+      // When the hand sweeps, the next frame is moments away, and will
+      //   be drawn on the new background anyway
+      if (program_handle_signals (sfd, quit) && !scheduler)
+        {
+        clock_gettime (CLOCK_REALTIME, now);
+        now->tv_nsec = 0;
+        draw = TRUE;
+        }
+      }
+    else if (fd == tzfd)
+      {
+      if (tz_cache_handle_events () && !scheduler)
+        {
+        clock_gettime (CLOCK_REALTIME, now);
+        now->tv_nsec = 0;
+        draw = TRUE;
+        }
+      }
+    else if (scheduler && fd == frame_scheduler_get_fd (scheduler))
+      draw |= frame_scheduler_expired (scheduler, now);
+    else if (timer && fd == tick_timer_get_fd (timer))
+      draw |= tick_timer_expired (timer, now);
+    }
+  return draw;
+  }
 
-// All these variables have to be global, because they are
-//  used by the signal handler
-FrameBuffer *fb = NULL; 
-int transparency = 40;
-static Region *wallpaper_region = NULL; 
-static int position_x = -1;
-static int position_y = -1;
 
 /*==========================================================================
 
-  program_signal_usr2
+  program_watch
 
-  When a URS2 is received, it means that the background has been
-  redrawn, so we must redraw also, using the new background. So
-  we have to sample the background from the framebuffer, and then
-  draw on top of this sample
+  Add fd to the set that the event loop waits on, for reading
 
 ==========================================================================*/
-void program_signal_usr2 (int dummy)
+static BOOL program_watch (int epfd, int fd)
   {
-  region_from_fb (wallpaper_region, fb, position_x, position_y);
-  region_darken (wallpaper_region, transparency);
+  struct epoll_event ev;
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) == 0) return TRUE;
+  log_error ("Can't watch for events: %s", strerror (errno));
+  return FALSE;
   }
 
 
 /*==========================================================================
 
-  program_check_context
+  program_get_output_integer 
+
+  Get a setting for a particular output. An output's own settings have
+  names like "x.1"; if it doesn't have its own, the setting with the
+  plain name, like "x", applies
 
 ==========================================================================*/
-BOOL program_check_context (const ProgramContext *context)
+static int program_get_output_integer (const ProgramContext *context, 
+      const char *name, int output, int deflt)
+  {
+  char key[64];
+  int value = program_context_get_integer (context, name, deflt);
+  return program_context_get_integer (context, 
+    program_context_output_key (name, output, key, sizeof (key)), value);
+  }
+
+/*==========================================================================
+  program_get_output_boolean 
+==========================================================================*/
+static BOOL program_get_output_boolean (const ProgramContext *context, 
+      const char *name, int output, BOOL deflt)
+  {
+  char key[64];
+  BOOL value = program_context_get_boolean (context, name, deflt);
+  return program_context_get_boolean (context, 
+    program_context_output_key (name, output, key, sizeof (key)), value);
+  }
+
+/*==========================================================================
+  program_get_output_string 
+==========================================================================*/
+static const char *program_get_output_string (const ProgramContext *context,
+      const char *name, int output, const char *deflt)
+  {
+  char key[64];
+  const char *value = program_context_get (context, 
+    program_context_output_key (name, output, key, sizeof (key)));
+  if (!value) value = program_context_get (context, name); 
+  return value ? value : deflt;
+  }
+
+
+/*==========================================================================
+
+  program_check_output
+
+==========================================================================*/
+static BOOL program_check_output (const Output *output)
   {
   LOG_IN
   BOOL ret = TRUE;
  
   if (ret)
     {
-    position_x = program_context_get_integer (context, "x", DEF_POSITION_X);
-    position_y = program_context_get_integer (context, "y", DEF_POSITION_Y);
-    int w = program_context_get_integer (context, "width", DEF_WIDTH);
-    int h = program_context_get_integer (context, "height", DEF_HEIGHT);
-
-    if (position_x + w > framebuffer_get_width (fb)
-        || position_y + h > framebuffer_get_height (fb)
-        || position_x < 0 || position_y < 0)
+    if (output->x + output->width > framebuffer_get_width (output->fb)
+        || output->y + output->height > framebuffer_get_height (output->fb)
+        || output->x < 0 || output->y < 0)
       {
-      log_error ("Position is out of bounds, compared to framebuffer size");
+      log_error ("%s: Position is out of bounds, compared to "
+        "framebuffer size", output->fbdev);
       ret = FALSE;
       }
     }
   
   if (ret)
     {
-    int t = program_context_get_integer 
-      (context, "transparency", DEF_TRANSPARENCY);
-    if (t < 0 || t > 100)
+    if (output->transparency < 0 || output->transparency > 100)
       {
       log_error ("Transparency is a percentage, 0-100");
       ret = FALSE;
@@ -101,10 +312,221 @@ BOOL program_check_context (const ProgramContext *context)
   }
 
 
+/*==========================================================================
+
+  program_open_output
+
+  Open the framebuffer for an output, and sample the background under
+  the clock. Errors are logged
+
+==========================================================================*/
+static BOOL program_open_output (const ProgramContext *context, 
+      Output *output, int n)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  output->fbdev = program_get_output_string (context, "fbdev", n, 
+    "/dev/fb0");
+  output->x = program_get_output_integer (context, "x", n, DEF_POSITION_X);
+  output->y = program_get_output_integer (context, "y", n, DEF_POSITION_Y);
+  output->width = program_get_output_integer (context, "width", n, 
+    DEF_WIDTH);
+  output->height = program_get_output_integer (context, "height", n, 
+    DEF_HEIGHT);
+  output->transparency = program_get_output_integer 
+    (context, "transparency", n, DEF_TRANSPARENCY);
+
+  output->fb = framebuffer_create (output->fbdev);
+  framebuffer_set_vsync (output->fb, program_get_output_boolean 
+    (context, "vsync", n, FALSE));
+  framebuffer_set_page_flip (output->fb, program_get_output_boolean 
+    (context, "page-flip", n, FALSE));
+  framebuffer_set_deferred_io (output->fb, program_get_output_boolean 
+    (context, "deferred-io", n, FALSE));
+  framebuffer_set_shadow (output->fb, program_get_output_boolean 
+    (context, "shadow", n, FALSE));
+  char *error = NULL;
+  framebuffer_init (output->fb, &error);
+  if (error == NULL)
+    {
+    if (program_check_output (output))
+      {
+      log_debug ("%s: clock area width is %d", output->fbdev, 
+        output->width); 
+      log_debug ("%s: clock TL corner is (%d, %d)", output->fbdev, 
+        output->x, output->y);
+      log_debug ("%s: clock background transparency is %d%%", 
+        output->fbdev, output->transparency); 
+      framebuffer_claim_rect (output->fb, output->x, output->y, 
+        output->width, output->height);
+      output->wallpaper = region_create_for_fb (output->fb, 
+        output->width, output->height);
+      program_resample_background (output);
+      ret = TRUE;
+      }
+    else
+      {
+      // Do nothing -- error already reported
+      }
+    }
+  else
+    {
+    log_error ("%s: %s", output->fbdev, error);
+    free (error);
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+  program_close_output
+==========================================================================*/
+static void program_close_output (Output *output)
+  {
+  LOG_IN
+  region_destroy (output->frame);
+  region_destroy (output->base);
+  region_destroy (output->wallpaper);
+  if (output->fb) framebuffer_destroy (output->fb);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  program_render_output
+
+  Draw the clock for time tm, and msec milliseconds, on one output's 
+  frame, without writing it to the framebuffer. Only the hands are 
+  drawn each time: the rest of the clock is drawn on the base, which 
+  is rebuilt when the background changes, or the date does
+
+==========================================================================*/
+static void program_render_output (Output *output, const struct tm *tm, 
+      int msec, BOOL seconds, BOOL date)
+  {
+  // If something else has drawn under the clock, our copy of the
+  //   background is out of date, whether we were told or not
+  if (framebuffer_shadow_is_stale (output->fb))
+    {
+    log_debug ("%s: background changed under the clock", output->fbdev);
+    program_resample_background (output);
+    }
+
+  int day = date ? tm->tm_year * 1000 + tm->tm_yday : 0;
+  if (output->background_changed || !output->base 
+       || day != output->base_day)
+    {
+    output->background_changed = FALSE;
+    region_destroy (output->base);
+    output->base = region_clone (output->wallpaper);
+    program_draw_clock_face (output->base, tm, date);
+    output->base_day = day;
+    region_destroy (output->frame);
+    output->frame = region_clone (output->base);
+    region_set_work_pool (output->frame, pool);
+    stats_add ("clock.base_rebuilds", 1);
+    }
+  else
+    region_revert (output->frame, output->base);
+
+  program_draw_clock_hands (output->frame, tm, msec, seconds);
+  }
+
+
+/*==========================================================================
+
+  program_present_output
+
+  Write what has changed in an output's frame to the framebuffer, and
+  show it
+
+==========================================================================*/
+static void program_present_output (Output *output)
+  {
+  framebuffer_begin_frame (output->fb);
+  region_to_fb (output->frame, output->fb, output->x, output->y);
+  framebuffer_present (output->fb);
+  }
+
+
+/*==========================================================================
+
+  program_render
+
+  Draw the clock for time when on all the outputs' frames
+
+==========================================================================*/
+static void program_render (const struct timespec *when, BOOL seconds, 
+      BOOL date)
+  {
+  struct tm tm;
+  tz_cache_localtime (when->tv_sec, &tm);
+  int msec = when->tv_nsec / 1000000;
+  for (int i = 0; i < n_outputs; i++)
+    program_render_output (&outputs[i], &tm, msec, seconds, date);
+  }
+
+
+/*==========================================================================
+
+  program_render_is_stale
+
+  Whether a frame drawn in advance can't be shown, because a background
+  has been resampled since
+
+==========================================================================*/
+static BOOL program_render_is_stale (void)
+  {
+  for (int i = 0; i < n_outputs; i++)
+    {
+    if (outputs[i].background_changed) return TRUE;
+    }
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  program_usec_since
+
+  The time in microseconds from when until now, on the wall clock. 
+  Negative if when is still to come
+
+==========================================================================*/
+static long program_usec_since (const struct timespec *when)
+  {
+  struct timespec now;
+  clock_gettime (CLOCK_REALTIME, &now);
+  return (now.tv_sec - when->tv_sec) * 1000000L
+    + (now.tv_nsec - when->tv_nsec) / 1000;
+  }
+
+
 /*==========================================================================
 
   program_run
 
+  All outputs are drawn in the same loop, so there is one wakeup per 
+  tick, however many framebuffers there are. In sweep mode, a tick is
+  a frame, paced by a FrameScheduler.
+
+  The loop is the only thing that draws, or samples the background.
+  It waits, with epoll, for a timer, or for a signal, which is read 
+  from a signalfd -- USR1 and USR2 are blocked, so they are never 
+  delivered to handlers, which could run in the middle of a frame.
+  TERM, INT and HUP are taken the same way, and end the loop, so that
+  the outputs are closed properly.
+
+  With --render-ahead, the frame for the next tick is drawn as soon as
+  the current one has been shown, in what would otherwise be idle 
+  time, so that at the tick it only has to be written to the 
+  framebuffer. If it can't be used -- it was finished too late, or the
+  clock was set, or the background resampled, in the meantime -- it is
+  drawn again. How much time was to spare, the slack, is logged at 
+  debug level and kept in the statistics
+
 ==========================================================================*/
 int program_run (ProgramContext *context)
   {
@@ -113,67 +535,205 @@ int program_run (ProgramContext *context)
 
   log_set_level (program_context_get_integer (context, "log-level", 
       LOG_WARNING));
-  const char *fbdev = "/dev/fb0";
-  const char *arg_fbdev = program_context_get (context, "fbdev");
-  if (arg_fbdev) fbdev = arg_fbdev;
 
-  fb = framebuffer_create (fbdev);
-  char *error = NULL;
-  framebuffer_init (fb, &error);
-  if (error == NULL)
+  program_set_hand_cache_budget (1024L * program_context_get_integer 
+    (context, "hand-cache", DEF_HAND_CACHE));
+  text_cache_set_budget (1024L * program_context_get_integer 
+    (context, "text-cache", DEF_TEXT_CACHE));
+  // This has to be done before any threads are started, so that they
+  //   block the signals too
+  sigset_t signals;
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGUSR1);
+  sigaddset (&signals, SIGUSR2);
+  sigaddset (&signals, SIGTERM);
+  sigaddset (&signals, SIGINT);
+  sigaddset (&signals, SIGHUP);
+  sigprocmask (SIG_BLOCK, &signals, NULL);
+  int sfd = signalfd (-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+  int epfd = epoll_create1 (EPOLL_CLOEXEC);
+  int tzfd = tz_cache_init ();
+
+  int threads = program_context_get_integer (context, "threads", 1);
+  if (threads > 1) pool = work_pool_create (threads);
+
+  int count = program_context_get_output_count (context);
+  outputs = calloc (count, sizeof (Output));
+  BOOL ok = TRUE;
+  if (sfd < 0 || epfd < 0)
+    {
+    log_error ("Can't set up event handling: %s", strerror (errno));
+    ok = FALSE;
+    }
+  for (int i = 0; i < count && ok; i++)
+    {
+    n_outputs = i + 1;
+    ok = program_open_output (context, &outputs[i], i);
+    }
+
+  // With --benchmark-op, one drawing operation is timed, on the first
+  //   output, instead of drawing the clock
+  const char *bench_op = program_context_get (context, "benchmark-op");
+  if (ok && bench_op)
+    {
+    if (program_context_get_integer (context, "log-level", 
+          LOG_WARNING) < LOG_INFO)
+      log_set_level (LOG_INFO);
+    microbench_run (bench_op, program_context_get_integer 
+      (context, "benchmark", DEF_BENCHMARK_OPS), outputs[0].fb, 
+      outputs[0].x, outputs[0].y, outputs[0].width, outputs[0].height);
+    }
+  else if (ok)
     {
-    if (program_check_context (context))
+    BOOL seconds = program_context_get_boolean 
+       (context, "seconds", FALSE); 
+    BOOL date = program_context_get_boolean 
+       (context, "date", FALSE); 
+    // Frames per second for a sweeping second hand, or zero for one
+    //   that ticks
+    int fps = program_context_get_integer (context, "sweep", 0);
+    if (fps > 0) seconds = TRUE;
+    // In benchmark mode, we draw this many frames as fast as we can,
+    //   advancing the time by one tick each frame, and then stop
+    int benchmark = program_context_get_integer 
+       (context, "benchmark", 0); 
+    int tick = seconds ? 1 : 60;
+    struct timespec now;
+    clock_gettime (CLOCK_REALTIME, &now);
+    if (fps == 0) now.tv_nsec = 0;
+    FrameScheduler *scheduler = NULL;
+    TickTimer *timer = NULL;
+    BOOL stop = !program_watch (epfd, sfd)
+      || (tzfd >= 0 && !program_watch (epfd, tzfd));
+    if (fps > 0 && benchmark == 0)
+      {
+      scheduler = frame_scheduler_create (fps);
+      stop = stop || !scheduler 
+        || !program_watch (epfd, frame_scheduler_get_fd (scheduler));
+      }
+    else if (benchmark == 0)
+      {
+      timer = tick_timer_create (tick);
+      stop = stop || !timer 
+        || !program_watch (epfd, tick_timer_get_fd (timer));
+      }
+    int frames = 0;
+    struct timespec bench_start;
+    if (benchmark > 0)
+      {
+      if (program_context_get_integer (context, "log-level", 
+            LOG_WARNING) < LOG_INFO)
+        log_set_level (LOG_INFO);
+      clock_gettime (CLOCK_MONOTONIC, &bench_start);
+      }
+
+    BOOL render_ahead = program_context_get_boolean 
+       (context, "render-ahead", FALSE) && benchmark == 0; 
+    // The time of the next tick, and the time the frame drawn in 
+    //   advance is for, if there is one
+    struct timespec due = { 0, 0 };
+    struct timespec ahead = { -1, 0 };
+    long min_slack = LONG_MAX;
+    long max_late = 0;
+    BOOL draw = TRUE;
+    while (!stop)
       {
-      int width = program_context_get_integer (context, "width", DEF_WIDTH);
-      int height = program_context_get_integer (context, "height", DEF_HEIGHT);
-      // Position was already set in check_context
-
-      int transparency = program_context_get_integer 
-        (context, "transparency", DEF_TRANSPARENCY);
-      BOOL seconds = program_context_get_boolean 
-         (context, "seconds", FALSE); 
-      BOOL date = program_context_get_boolean 
-         (context, "date", FALSE); 
-
-      log_debug ("Clock area width is %d", width); 
-      log_debug ("Clock TL corner is (%d, %d)", position_x, position_y);
-      log_debug ("Clock background transparency is %d%%", transparency); 
-      wallpaper_region = region_create (width, height);
-      region_from_fb (wallpaper_region, fb, position_x, position_y);
-      region_darken (wallpaper_region, transparency);
-
-      signal (SIGUSR2, program_signal_usr2); 
-      BOOL stop = FALSE;
-      while (!stop)
+      if (draw)
         {
-        Region *r = region_clone (wallpaper_region);
+        BOOL on_time = now.tv_sec == due.tv_sec 
+          && now.tv_nsec == due.tv_nsec;
+        if (now.tv_sec == ahead.tv_sec && now.tv_nsec == ahead.tv_nsec
+             && !program_render_is_stale ())
+          stats_add ("ahead.used", 1);
+        else
+          {
+          if (ahead.tv_sec >= 0) stats_add ("ahead.discarded", 1);
+          program_render (&now, seconds, date);
+          }
+        ahead.tv_sec = -1;
+        for (int i = 0; i < n_outputs; i++)
+          program_present_output (&outputs[i]);
+        frames++;
+
+        // How late the clock was shown, relative to the tick it shows,
+        //   if it was drawn for a tick
+        if (on_time)
+          {
+          long late = program_usec_since (&now);
+          log_debug ("Frame shown %ld usec after its time", late);
+          if (late > max_late) max_late = late;
+          stats_set ("clock.shown_late_usec", late);
+          stats_set ("clock.max_shown_late_usec", max_late);
+          }
 
-        program_draw_clock_in_region (r, seconds, date);
+        if (scheduler) 
+          {
+          frame_scheduler_frame_done (scheduler);
+          frame_scheduler_get_due (scheduler, &due);
+          }
+        else if (timer)
+          tick_timer_get_due (timer, &due);
 
-        region_to_fb (r, fb, position_x, position_y);
-        region_destroy (r);
-      
-        if (seconds)
-          sleep (1);
+        if (render_ahead)
+          {
+          ahead = due;
+          program_render (&ahead, seconds, date);
+          long slack = -program_usec_since (&ahead);
+          log_debug ("Next frame ready %ld usec early", slack);
+          if (slack < min_slack) min_slack = slack;
+          stats_set ("ahead.slack_usec", slack);
+          stats_set ("ahead.min_slack_usec", min_slack);
+          if (slack < 0) stats_add ("ahead.late", 1);
+          }
+        }
+    
+      if (benchmark > 0)
+        {
+        if (fps > 0)
+          {
+          now.tv_nsec += 1000000000L / fps;
+          now.tv_sec += now.tv_nsec / 1000000000L;
+          now.tv_nsec %= 1000000000L;
+          }
         else
-          sleep (60);
+          now.tv_sec += tick;
+        if (frames >= benchmark) stop = TRUE;
+        program_handle_signals (sfd, &stop);
         }
-
-      region_destroy (wallpaper_region);
-      framebuffer_deinit (fb);
+      else
+        draw = program_wait (epfd, sfd, tzfd, scheduler, timer, &now,
+          &stop);
       }
-    else
+    if (scheduler) frame_scheduler_destroy (scheduler);
+    if (timer) tick_timer_destroy (timer);
+
+    if (benchmark > 0)
       {
-      // Do nothing -- error already reported
+      struct timespec bench_end;
+      clock_gettime (CLOCK_MONOTONIC, &bench_end);
+      long usec = (bench_end.tv_sec - bench_start.tv_sec) * 1000000 
+        + (bench_end.tv_nsec - bench_start.tv_nsec) / 1000;
+      log_info ("Benchmark: %d frames in %ld usec, %ld usec per frame", 
+        frames, usec, usec / frames);
+      stats_log ();
       }
-    framebuffer_destroy (fb);
-    }
-  else
-    {
-    log_error (error);
-    free (error);
     }
 
+  // The signals stay blocked: there's nothing to do with them now
+  if (epfd >= 0) close (epfd);
+  if (sfd >= 0) close (sfd);
+  for (int i = 0; i < n_outputs; i++)
+    program_close_output (&outputs[i]);
+  n_outputs = 0;
+  free (outputs);
+  outputs = NULL;
+  program_free_clock_caches ();
+  text_cache_free ();
+  tz_cache_free ();
+  if (pool) work_pool_destroy (pool);
+  pool = NULL;
+
   return 0;
   }
 
+
@@ -22,6 +22,7 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <getopt.h>
+#include <ctype.h>
 #include "feature.h" 
 #include "defs.h" 
 #include "log.h" 
@@ -30,6 +31,9 @@
 #include "string.h"
 #include "usage.h"
 
+// The most framebuffers that can be drawn on at once
+#define MAX_OUTPUTS 16
+
 struct _ProgramContext
   {
   Props *props;
@@ -102,9 +106,28 @@ BOOL program_context_parse_command_line (ProgramContext *self,
       {"transparency", required_argument, NULL, 't'},
       {"width", required_argument, NULL, 'w'},
       {"height", required_argument, NULL, 'h'},
+      {"vsync", no_argument, NULL, 0},
+      {"page-flip", no_argument, NULL, 0},
+      {"deferred-io", no_argument, NULL, 0},
+      {"shadow", no_argument, NULL, 0},
+      {"hand-cache", required_argument, NULL, 0},
+      {"text-cache", required_argument, NULL, 0},
+      {"threads", required_argument, NULL, 0},
+      {"sweep", required_argument, NULL, 0},
+      {"render-ahead", no_argument, NULL, 0},
+      {"benchmark", required_argument, NULL, 0},
+      {"benchmark-op", required_argument, NULL, 0},
       {0, 0, 0, 0}
     };
 
+   // Each --fbdev starts a new output, and the display options that 
+   //   follow it apply only to that output. Display options before the
+   //   first --fbdev apply to all outputs
+   int output = -1;
+   char key[64];
+#define OUTPUT_KEY(name) \
+   program_context_output_key (name, output, key, sizeof (key))
+
    int opt;
    while (ret)
      {
@@ -128,17 +151,47 @@ BOOL program_context_parse_command_line (ProgramContext *self,
          else if (strcmp (long_options[option_index].name, "log-level") == 0)
            program_context_put_integer (self, "log-level", atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "width") == 0)
-           program_context_put_integer (self, "width", atoi (optarg)); 
+           program_context_put_integer (self, OUTPUT_KEY ("width"), 
+             atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "height") == 0)
-           program_context_put_integer (self, "height", atoi (optarg)); 
+           program_context_put_integer (self, OUTPUT_KEY ("height"), 
+             atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "x") == 0)
-           program_context_put_integer (self, "x", atoi (optarg)); 
+           program_context_put_integer (self, OUTPUT_KEY ("x"), 
+             atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "y") == 0)
-           program_context_put_integer (self, "y", atoi (optarg)); 
+           program_context_put_integer (self, OUTPUT_KEY ("y"), 
+             atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "transparency") == 0)
-           program_context_put_integer (self, "transparency", atoi (optarg)); 
+           program_context_put_integer (self, OUTPUT_KEY ("transparency"), 
+             atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "fbdev") == 0)
-           program_context_put (self, "fbdev", optarg); 
+           {
+           output++;
+           program_context_put (self, OUTPUT_KEY ("fbdev"), optarg); 
+           }
+         else if (strcmp (long_options[option_index].name, "vsync") == 0)
+           program_context_put_boolean (self, OUTPUT_KEY ("vsync"), TRUE);
+         else if (strcmp (long_options[option_index].name, "page-flip") == 0)
+           program_context_put_boolean (self, OUTPUT_KEY ("page-flip"), TRUE);
+         else if (strcmp (long_options[option_index].name, "deferred-io") == 0)
+           program_context_put_boolean (self, OUTPUT_KEY ("deferred-io"), TRUE);
+         else if (strcmp (long_options[option_index].name, "shadow") == 0)
+           program_context_put_boolean (self, OUTPUT_KEY ("shadow"), TRUE);
+         else if (strcmp (long_options[option_index].name, "hand-cache") == 0)
+           program_context_put_integer (self, "hand-cache", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "text-cache") == 0)
+           program_context_put_integer (self, "text-cache", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "threads") == 0)
+           program_context_put_integer (self, "threads", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "sweep") == 0)
+           program_context_put_integer (self, "sweep", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "render-ahead") == 0)
+           program_context_put_boolean (self, "render-ahead", TRUE);
+         else if (strcmp (long_options[option_index].name, "benchmark") == 0)
+           program_context_put_integer (self, "benchmark", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "benchmark-op") == 0)
+           program_context_put (self, "benchmark-op", optarg); 
          else
            exit (-1);
          break;
@@ -152,23 +205,28 @@ BOOL program_context_parse_command_line (ProgramContext *self,
          program_context_put_boolean (self, "seconds", TRUE); break;
        case 'l': program_context_put_integer (self, "log-level", 
            atoi (optarg)); break;
-       case 'w': program_context_put_integer (self, "width", 
+       case 'w': program_context_put_integer (self, OUTPUT_KEY ("width"), 
            atoi (optarg)); break;
-       case 'h': program_context_put_integer (self, "height", 
+       case 'h': program_context_put_integer (self, OUTPUT_KEY ("height"), 
            atoi (optarg)); break;
-       case 'x': program_context_put_integer (self, "x", 
+       case 'x': program_context_put_integer (self, OUTPUT_KEY ("x"), 
            atoi (optarg)); break;
-       case 'y': program_context_put_integer (self, "y", 
+       case 'y': program_context_put_integer (self, OUTPUT_KEY ("y"), 
            atoi (optarg)); break;
-       case 't': program_context_put_integer (self, "transparency", 
+       case 't': program_context_put_integer (self, OUTPUT_KEY ("transparency"), 
            atoi (optarg)); break;
-       case 'f': program_context_put (self, "fbdev", 
-           optarg); break;
+       case 'f': 
+         output++;
+         program_context_put (self, OUTPUT_KEY ("fbdev"), optarg); 
+         break;
        default:
          ret = FALSE; 
        }
     }
 
+#undef OUTPUT_KEY
+
+
   if (ret)
     {
     self->nonswitch_argc = argc - optind + 1;
@@ -201,6 +259,57 @@ BOOL program_context_parse_command_line (ProgramContext *self,
   }
 
 
+/*==========================================================================
+  program_context_output_key
+
+  Get the name of the property that holds a setting for a particular 
+  output -- "x.0" for the first output, "x.1" for the second, and so on.
+  If output is negative, the name is unchanged: that property holds the
+  setting for outputs that don't have their own. The name is written
+  into buf, which is returned
+==========================================================================*/
+const char *program_context_output_key (const char *name, int output, 
+    char *buf, int len)
+  {
+  if (output < 0)
+    snprintf (buf, len, "%s", name);
+  else
+    snprintf (buf, len, "%s.%d", name, output);
+  return buf;
+  }
+
+
+/*==========================================================================
+  program_context_get_output_count
+
+  The number of outputs: one more than the highest n for which there is
+  an "fbdev.n" property, whether it was set by --fbdev or in an RC 
+  file. There is always at least one output, which uses "fbdev", or
+  the default device, if there are none. Outputs beyond MAX_OUTPUTS 
+  are ignored, with a warning, so that a mistyped number in an RC file
+  doesn't open the same device a thousand times
+==========================================================================*/
+int program_context_get_output_count (const ProgramContext *self)
+  {
+  int count = 1;
+  int l = props_get_count (self->props);
+  for (int i = 0; i < l; i++)
+    {
+    const char *name = props_get_name (self->props, i);
+    if (strncmp (name, "fbdev.", 6) != 0 || !isdigit (name[6])) continue;
+    char *end;
+    long n = strtol (name + 6, &end, 10);
+    if (*end != 0) continue;
+    if (n >= MAX_OUTPUTS)
+      log_warning ("Ignoring %s: there can be at most %d outputs", 
+        name, MAX_OUTPUTS);
+    else if (n + 1 > count)
+      count = n + 1;
+    }
+  return count;
+  }
+
+
 /*==========================================================================
   context_destroy
 ==========================================================================*/
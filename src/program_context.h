@@ -39,6 +39,9 @@ int  program_context_get_integer (const ProgramContext *self,
     const char *key, int deflt);
 int64_t program_context_get_int64 (const ProgramContext *self, 
     const char *key, int64_t deflt);
+const char *program_context_output_key (const char *name, int output, 
+    char *buf, int len);
+int program_context_get_output_count (const ProgramContext *self);
 BOOL program_context_parse_command_line (ProgramContext *self, 
      int argc, char **argv);
 int program_context_get_nonswitch_argc (const ProgramContext *self);
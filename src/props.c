@@ -302,6 +302,28 @@ BOOL props_read_from_file (Props *self, const char *filename)
   }
 
  
+/*==========================================================================
+  props_get_count
+*==========================================================================*/
+int props_get_count (const Props *self)
+  {
+  return list_length (self->list);
+  }
+
+
+/*==========================================================================
+  props_get_name
+
+  The name of the i'th property, 0 to props_get_count - 1. The order
+  is not significant
+*==========================================================================*/
+const char *props_get_name (const Props *self, int i)
+  {
+  const NameValuePair *nvp = list_get (self->list, i);
+  return nvp_get_name (nvp);
+  }
+
+
 /*==========================================================================
   props_read_from_file
 *==========================================================================*/
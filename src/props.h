@@ -28,6 +28,8 @@ void        props_put_int64 (Props *self, const char *key, int64_t value);
 int         props_get_integer (const Props *self, const char *key, int deflt);
 int64_t     props_get_int64 (const Props *self, const char *key, 
               int64_t deflt);
+int         props_get_count (const Props *self);
+const char *props_get_name (const Props *self, int i);
 void        props_dump (const Props *self);
 
 END_DECLS
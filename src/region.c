@@ -26,92 +26,541 @@
 #include "defs.h" 
 #include "log.h" 
 #include "framebuffer.h" 
+#include "blit.h" 
 #include "region.h" 
 #include "bitmap_font.h" 
+#include "trig.h" 
+#include "gamma.h" 
+#include "textcache.h" 
+#include "workpool.h" 
 
-// Bytes per pixel
-#define BPP 3
+// Each scanline starts on a boundary of this many bytes, and the pixel
+//   data as a whole on a cache-line boundary
+#define ROW_ALIGN 16
+#define DATA_ALIGN 64
 
-static float HALFPI = M_PI / 2.0; 
 
+// The most rectangles we will track separately. Beyond this, new 
+//   rectangles get merged into whichever existing one grows least
+#define MAX_RECTS 64
+
+// Lines are recorded as damaged in bands of this many pixels along their
+//   length, so a diagonal line does not damage its whole bounding box
+#define LINE_BAND 16
+
+// When a region has a work pool, the per-frame operations -- reverting,
+//   drawing masks and polygons, and writing to the framebuffer -- are 
+//   split into square tiles of this many pixels, on a grid fixed to the
+//   region. A tile of 32-bit pixels fits comfortably in an L2 cache
+#define TILE_SIZE 128
+
+typedef struct _RectList
+  {
+  int count;
+  RegionRect rects[MAX_RECTS];
+  } RectList;
+
+// Pixels are stored in whatever layout the framebuffer uses, so that 
+//   presenting a frame is a plain copy of each scanline
 struct _Region
   {
   int w;
   int h;
+  PixelFormat format;
+  int bytes;  // Per pixel
+  int stride; // Bytes per scanline, including padding
   BYTE *data;
+  // Whether partly-covered pixels are blended in linear light 
+  BOOL gamma;
+  // The threads that tiles are drawn on, or NULL to draw everything 
+  //   on the calling thread
+  WorkPool *pool;
+  // Areas changed since the region was last written to a framebuffer 
+  RectList damage;
+  // Areas changed by drawing since the last call to region_revert
+  RectList drawn;
+  // Areas written by the previous region_to_fb. With page flipping, the
+  //   page we write to is two frames old, so these have to be written
+  //   again
+  RectList flushed;
   }; 
 
+// One row of a RegionMask: the pixels from x1 to x2 (excluded), whose 
+//   coverage values start at offset in the mask data
+typedef struct _MaskRow
+  {
+  int x1;
+  int x2;
+  int offset;
+  } MaskRow;
+
+// An anti-aliased shape, cut out of a region by region_get_mask. Each
+//   pixel is a byte, which is how much of it the shape covers
+struct _RegionMask
+  {
+  int y;
+  int h;
+  MaskRow *rows;
+  BYTE *data;
+  int size;
+  };
+
 
 /*==========================================================================
   
   math helper functions
 
-  These are all used by the line anti-aliasing functions. I have defined
-  them as 'static inline' in the hope that gcc will do the right thing
-  and write them straight into the code
-    
 *==========================================================================*/
-static inline float absolute (float x)
-  {
-  if (x < 0) 
-    return -x;
-  else
-    return x;
-  }
-
 static inline void swap (int *x, int *y)
   {
   int t = *y;
   *y = *x;
   *x = t;
   }
-
-static inline float ipart (float x) 
-  { 
-  return floor (x); 
-  } 
-  
-static inline float rnd (float x) 
-  { 
-  return ipart (x + 0.5);
-  } 
   
-static inline float fpart (float x) 
-  { 
-  return x - floor (x);
-  } 
+
+/*==========================================================================
   
-static inline float rfpart (float x) 
-  { 
-  return 1 - fpart (x); 
-  } 
+  pixel access helpers
+
+  Pixel values are passed around in the form produced by blit_pack_pixel,
+  and stored in 2, 3, or 4 bytes according to the layout
+    
+*==========================================================================*/
+static inline BYTE *pixel_ptr (const Region *self, int x, int y)
+  {
+  return self->data + y * self->stride + x * self->bytes;
+  }
+
+static inline void store_pixel (BYTE *p, int bytes, uint32_t v)
+  {
+  switch (bytes)
+    {
+    case 4: *(uint32_t *)p = v; break;
+    case 2: *(uint16_t *)p = v; break;
+    default: p[0] = v; p[1] = v >> 8; p[2] = v >> 16;
+    }
+  }
+
+static inline uint32_t load_pixel (const BYTE *p, int bytes)
+  {
+  switch (bytes)
+    {
+    case 4: return *(const uint32_t *)p;
+    case 2: return *(const uint16_t *)p;
+    default: return p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+  }
+
+// Mix c and p in the proportions a:255-a, rounding to nearest
+static inline int blend_byte (int c, int p, int a)
+  {
+  int x = c * a + p * (255 - a) + 128;
+  return (x + (x >> 8)) >> 8;
+  }
+
+// Blend a colour over the pixel at p, covering a/255 of it. colour is
+//   r,g,b packed for the region's layout. Normally the mixing is done in
+//   linear light. Without gamma, layouts with a byte per channel are 
+//   blended a byte at a time, without unpacking
+static inline void blend_pixel (const Region *self, BYTE *p, 
+      uint32_t colour, BYTE r, BYTE g, BYTE b, int a)
+  {
+  if (self->bytes == 2)
+    {
+    BYTE br, bg, bb;
+    blit_unpack_pixel (self->format, load_pixel (p, 2), &br, &bg, &bb);
+    if (self->gamma)
+      store_pixel (p, 2, blit_pack_pixel (self->format, gamma_blend (r, br, a),
+        gamma_blend (g, bg, a), gamma_blend (b, bb, a)));
+    else
+      store_pixel (p, 2, blit_pack_pixel (self->format, blend_byte (r, br, a),
+        blend_byte (g, bg, a), blend_byte (b, bb, a)));
+    }
+  else if (self->gamma)
+    {
+    // Bytes 0 to 2 are the colour channels, in some order, and any 
+    //   fourth byte is padding or opacity, which is left alone
+    p[0] = gamma_blend (colour & 0xFF, p[0], a);
+    p[1] = gamma_blend ((colour >> 8) & 0xFF, p[1], a);
+    p[2] = gamma_blend ((colour >> 16) & 0xFF, p[2], a);
+    }
+  else if (self->bytes == 4)
+    {
+    // Two channels at a time, in 16-bit lanes
+    uint32_t v = *(uint32_t *)p;
+    uint32_t rb = (colour & 0x00FF00FF) * a + (v & 0x00FF00FF) * (255 - a)
+      + 0x00800080;
+    uint32_t ag = ((colour >> 8) & 0x00FF00FF) * a 
+      + ((v >> 8) & 0x00FF00FF) * (255 - a) + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+    *(uint32_t *)p = rb | ag;
+    }
+  else
+    {
+    for (int i = 0; i < self->bytes; i++)
+      p[i] = blend_byte ((colour >> (8 * i)) & 0xFF, p[i], a);
+    }
+  }
+
+
+/*==========================================================================
   
+  rectangle list helpers
+
+  Rectangles are held in region coordinates, with the right and bottom
+  edges excluded
+    
+*==========================================================================*/
+static inline int rect_area (const RegionRect *r)
+  {
+  return (r->x2 - r->x1) * (r->y2 - r->y1);
+  }
+
+static inline void rect_union (RegionRect *r, const RegionRect *other)
+  {
+  if (other->x1 < r->x1) r->x1 = other->x1;
+  if (other->y1 < r->y1) r->y1 = other->y1;
+  if (other->x2 > r->x2) r->x2 = other->x2;
+  if (other->y2 > r->y2) r->y2 = other->y2;
+  }
+
+static inline int rect_union_area (const RegionRect *a, 
+      const RegionRect *b)
+  {
+  RegionRect u = *a;
+  rect_union (&u, b);
+  return rect_area (&u);
+  }
+
+static void rect_list_add (RectList *self, const RegionRect *r)
+  {
+  for (int i = 0; i < self->count; i++)
+    {
+    RegionRect *e = &self->rects[i];
+    if (r->x1 >= e->x1 && r->y1 >= e->y1 && r->x2 <= e->x2 && r->y2 <= e->y2)
+      return; // Already covered 
+    }
+
+  if (self->count < MAX_RECTS)
+    {
+    self->rects[self->count++] = *r;
+    }
+  else
+    {
+    int best = 0;
+    int best_growth = rect_union_area (&self->rects[0], r) 
+       - rect_area (&self->rects[0]);
+    for (int i = 1; i < self->count; i++)
+      {
+      int growth = rect_union_area (&self->rects[i], r) 
+         - rect_area (&self->rects[i]);
+      if (growth < best_growth)
+        {
+        best = i;
+        best_growth = growth;
+        }
+      }
+    rect_union (&self->rects[best], r);
+    }
+  }
+
+/* Merge any pair of rectangles whose bounding box is no larger than 
+   the two of them separately -- that is, which overlap enough that 
+   writing the bounding box costs nothing extra. Repeat until no more
+   merges happen. */
+static void rect_list_coalesce (RectList *self)
+  {
+  BOOL merged = TRUE;
+  while (merged)
+    {
+    merged = FALSE;
+    for (int i = 0; i < self->count && !merged; i++)
+      {
+      for (int j = i + 1; j < self->count && !merged; j++)
+        {
+        RegionRect *a = &self->rects[i];
+        RegionRect *b = &self->rects[j];
+        if (rect_union_area (a, b) <= rect_area (a) + rect_area (b))
+          {
+          rect_union (a, b);
+          self->rects[j] = self->rects[--self->count];
+          merged = TRUE;
+          }
+        }
+      }
+    }
+  }
 
 
 /*==========================================================================
-  region_create
+
+  tiles
+
+  An operation is split into tiles by giving it a function that does
+  its work within a clipping rectangle. Every tile that the operation's
+  bounding box overlaps becomes one task for the work pool. Tiles 
+  divide the pixels between them, so they can be drawn in any order,
+  on any thread, with the same result; but a tile function must not 
+  change anything outside its pixels, like the damage lists. Without 
+  a pool, the function is called once, for the whole bounding box.
+
 *==========================================================================*/
-Region *region_create (int w, int h)
+
+// Do some part of an operation, within clip. tile_x is the tile's 
+//   column, counting from zero at the operation's left edge, for 
+//   functions that need per-column scratch space
+typedef void (*TileFn) (Region *self, const RegionRect *clip, 
+                 int tile_x, void *arg);
+
+typedef struct _TileJob
+  {
+  Region *self;
+  RegionRect box;
+  int tx1;
+  int ty1;
+  int across;
+  TileFn fn;
+  void *arg;
+  } TileJob;
+
+static void tile_job_run (void *arg, int task)
+  {
+  const TileJob *job = arg;
+  int tx = task % job->across;
+  int ty = task / job->across;
+  RegionRect clip;
+  clip.x1 = (job->tx1 + tx) * TILE_SIZE;
+  clip.y1 = (job->ty1 + ty) * TILE_SIZE;
+  clip.x2 = clip.x1 + TILE_SIZE;
+  clip.y2 = clip.y1 + TILE_SIZE;
+  if (clip.x1 < job->box.x1) clip.x1 = job->box.x1;
+  if (clip.y1 < job->box.y1) clip.y1 = job->box.y1;
+  if (clip.x2 > job->box.x2) clip.x2 = job->box.x2;
+  if (clip.y2 > job->box.y2) clip.y2 = job->box.y2;
+  job->fn (job->self, &clip, tx, job->arg);
+  }
+
+static inline BOOL use_tiles (const WorkPool *pool)
+  {
+  return pool && work_pool_get_threads (pool) > 1;
+  }
+
+// The number of tile columns that run_tiles will split box into
+static int tiles_across (const WorkPool *pool, const RegionRect *box)
+  {
+  if (!use_tiles (pool)) return 1;
+  return (box->x2 - 1) / TILE_SIZE - box->x1 / TILE_SIZE + 1;
+  }
+
+// Carry out fn over box, which must be within the region, on the 
+//   threads of pool, which may be NULL
+static void run_tiles (Region *self, WorkPool *pool, const RegionRect *box,
+      TileFn fn, void *arg)
+  {
+  if (box->x1 >= box->x2 || box->y1 >= box->y2) return;
+  if (!use_tiles (pool))
+    {
+    fn (self, box, 0, arg);
+    return;
+    }
+  TileJob job = { self, *box, box->x1 / TILE_SIZE, box->y1 / TILE_SIZE, 
+    tiles_across (pool, box), fn, arg };
+  int down = (box->y2 - 1) / TILE_SIZE - job.ty1 + 1;
+  work_pool_run (pool, job.across * down, tile_job_run, &job);
+  }
+
+// The smallest rectangle containing all those in list, which must not
+//   be empty
+static RegionRect rect_list_bounds (const RectList *list)
+  {
+  RegionRect box = list->rects[0];
+  for (int i = 1; i < list->count; i++)
+    rect_union (&box, &list->rects[i]);
+  return box;
+  }
+
+
+/*==========================================================================
+  region_add_damage
+
+  Record that the specified area has changed. The area is clipped to
+  the region; x2,y2 are excluded
+*==========================================================================*/
+void region_add_damage (Region *self, int x1, int y1, int x2, int y2)
+  {
+  RegionRect r;
+  r.x1 = x1 < 0 ? 0 : x1;
+  r.y1 = y1 < 0 ? 0 : y1;
+  r.x2 = x2 > self->w ? self->w : x2;
+  r.y2 = y2 > self->h ? self->h : y2;
+  if (r.x1 < r.x2 && r.y1 < r.y2)
+    {
+    rect_list_add (&self->damage, &r);
+    rect_list_add (&self->drawn, &r);
+    }
+  }
+
+/*==========================================================================
+
+  add_line_damage
+
+  Record the damage done by a line, as a series of short bands. The 
+  anti-aliased pixels can fall one either side of the ideal line, and 
+  the end points are rounded, so each band gets a margin
+
+*==========================================================================*/
+static void add_line_damage (Region *self, int x0, int y0, int x1, int y1)
+  {
+  int dx = x1 - x0;
+  int dy = y1 - y0;
+  int steps = abs (dx) > abs (dy) ? abs (dx) : abs (dy);
+  int bands = steps / LINE_BAND + 1;
+  for (int i = 0; i < bands; i++)
+    {
+    int ax = x0 + dx * i / bands;
+    int ay = y0 + dy * i / bands;
+    int bx = x0 + dx * (i + 1) / bands;
+    int by = y0 + dy * (i + 1) / bands;
+    region_add_damage (self, (ax < bx ? ax : bx) - 1, (ay < by ? ay : by) - 1,
+      (ax > bx ? ax : bx) + 2, (ay > by ? ay : by) + 2);
+    }
+  }
+
+/*==========================================================================
+  region_damage_all
+*==========================================================================*/
+void region_damage_all (Region *self)
+  {
+  self->damage.count = 0;
+  self->drawn.count = 0;
+  self->flushed.count = 0;
+  region_add_damage (self, 0, 0, self->w, self->h);
+  }
+
+/*==========================================================================
+  region_get_damage_count
+*==========================================================================*/
+int region_get_damage_count (const Region *self)
+  {
+  return self->damage.count;
+  }
+
+/*==========================================================================
+  region_get_damage
+*==========================================================================*/
+const RegionRect *region_get_damage (const Region *self, int i)
+  {
+  return &self->damage.rects[i];
+  }
+
+/*==========================================================================
+
+  region_revert
+
+  Undo all the drawing done since the last revert, by copying the 
+  affected areas back from bg, which must have the same size and
+  layout. The reverted areas remain damaged until the region is next
+  written to a framebuffer -- they have changed, after all
+
+*==========================================================================*/
+typedef struct _RevertJob
+  {
+  const Region *bg;
+  const RectList *rects;
+  } RevertJob;
+
+static void revert_tile (Region *self, const RegionRect *clip, 
+      int tile_x, void *arg)
+  {
+  const RevertJob *job = arg;
+  for (int i = 0; i < job->rects->count; i++)
+    {
+    RegionRect r = job->rects->rects[i];
+    if (r.x1 < clip->x1) r.x1 = clip->x1;
+    if (r.y1 < clip->y1) r.y1 = clip->y1;
+    if (r.x2 > clip->x2) r.x2 = clip->x2;
+    if (r.y2 > clip->y2) r.y2 = clip->y2;
+    if (r.x1 >= r.x2 || r.y1 >= r.y2) continue;
+    int row_bytes = (r.x2 - r.x1) * self->bytes;
+    for (int y = r.y1; y < r.y2; y++)
+      memcpy (pixel_ptr (self, r.x1, y), pixel_ptr (job->bg, r.x1, y), 
+        row_bytes);
+    }
+  }
+
+void region_revert (Region *self, const Region *bg)
+  {
+  LOG_IN
+  if (self->drawn.count > 0)
+    {
+    RegionRect box = rect_list_bounds (&self->drawn);
+    RevertJob job = { bg, &self->drawn };
+    run_tiles (self, self->pool, &box, revert_tile, &job);
+    }
+  for (int i = 0; i < self->drawn.count; i++)
+    rect_list_add (&self->damage, &self->drawn.rects[i]);
+  self->drawn.count = 0;
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  region_create_with_format
+*==========================================================================*/
+Region *region_create_with_format (int w, int h, PixelFormat format)
   {
   LOG_IN
   Region *self = malloc (sizeof (Region));
   self->w = w;
   self->h = h;
-  self->data = malloc (w * h * BPP);
+  self->format = format;
+  self->bytes = blit_get_kernels (format)->bytes_per_pixel;
+  self->stride = (w * self->bytes + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+  self->gamma = TRUE;
+  self->pool = NULL;
+  gamma_init ();
+  if (posix_memalign ((void **)&self->data, DATA_ALIGN, 
+        self->stride * h) != 0)
+    self->data = NULL;
+  region_damage_all (self);
   LOG_OUT 
   return self;
   }
 
+/*==========================================================================
+  region_create
+
+  Creates a region with 32-bit pixels. Regions that will be written to
+  a framebuffer should be created using region_create_for_fb, so the
+  write is a straight copy
+*==========================================================================*/
+Region *region_create (int w, int h)
+  {
+  return region_create_with_format (w, h, PIXEL_FORMAT_XRGB8888);
+  }
+
+/*==========================================================================
+  region_create_for_fb
+*==========================================================================*/
+Region *region_create_for_fb (const FrameBuffer *fb, int w, int h)
+  {
+  return region_create_with_format (w, h, framebuffer_get_format (fb));
+  }
+
 /*==========================================================================
   region_clone
 *==========================================================================*/
 Region *region_clone (const Region *other)
   {
   LOG_IN
-  Region *self = region_create (other->w, other->h);
+  Region *self = region_create_with_format (other->w, other->h, 
+    other->format);
 
-  int size = self->w * self->h * BPP;
-  memcpy (self->data, other->data, size); 
+  memcpy (self->data, other->data, self->stride * self->h); 
+  self->gamma = other->gamma;
+  self->pool = other->pool;
  
   LOG_OUT
   return self;
@@ -119,42 +568,21 @@ Region *region_clone (const Region *other)
 
 /*==========================================================================
   region_set_pixel
+
+  Note that setting individual pixels does not record damage -- that
+  would be far too expensive. Callers should use region_add_damage on
+  the area they draw
 *==========================================================================*/
 void region_set_pixel (Region *self, int x, int y, 
       BYTE r, BYTE g, BYTE b)
   {
   if (x >= 0 && x < self->w && y >= 0 && y < self->h)
     {
-    int index24 = (y * self->w + x) * BPP;
-    self->data [index24++] = b;
-    self->data [index24++] = g;
-    self->data [index24] = r;
+    store_pixel (pixel_ptr (self, x, y), self->bytes, 
+      blit_pack_pixel (self->format, r, g, b));
     }
   }
 
-/*==========================================================================
-  region_set_pixel_t
-
-  Set a pixel with a specific 'brightness'. This is just a helper to
-  void reproducing all the per-channel brightness code repeatedly 
-  elsewhere
-*==========================================================================*/
-void region_set_pixel_t (Region *self, int x, int y, 
-      BYTE r, BYTE g, BYTE b, float t)
-  {
-  b = (BYTE) (t * (float)b);
-  g = (BYTE) (t * (float)g);
-  r = (BYTE) (t * (float)r);
-  if (x > 0 && x < self->w && y > 0 && y < self->h)
-    {
-    int index24 = (y * self->w + x) * BPP;
-    self->data [index24 + 0] = b;
-    self->data [index24 + 1] = g;
-    self->data [index24 + 2] = r;
-    }
-  }
-
-
 /*==========================================================================
   region_fill_rect
   x2,y2 point is _excluded_
@@ -163,13 +591,21 @@ void region_fill_rect (Region *self, int x1, int y1,
       int x2, int y2, BYTE r, BYTE g, BYTE b)
   {
   LOG_IN
-  if (x1 > x2) { int t = x1; x2 = x1; x1 = t; }
-  if (y1 > y2) { int t = y1; y2 = y1; y1 = t; }
+  if (x1 > x2) swap (&x1, &x2);
+  if (y1 > y2) swap (&y1, &y2);
+  if (x1 < 0) x1 = 0;
+  if (y1 < 0) y1 = 0;
+  if (x2 > self->w) x2 = self->w;
+  if (y2 > self->h) y2 = self->h;
+  region_add_damage (self, x1, y1, x2, y2);
+  uint32_t v = blit_pack_pixel (self->format, r, g, b);
   for (int y = y1; y < y2; y++)
     {
+    BYTE *p = pixel_ptr (self, x1, y);
     for (int x = x1; x < x2; x++)
       {
-      region_set_pixel (self, x, y, r, g, b);
+      store_pixel (p, self->bytes, v);
+      p += self->bytes;
       }
     }
   LOG_OUT
@@ -191,34 +627,357 @@ void region_destroy (Region *self)
 
 
 /*==========================================================================
-  region_to_fb
+
+  region_clear
+
+  Set every pixel to zero, and forget all damage. This is for scratch
+  regions that are drawn on and then cut up with region_get_mask, and
+  never written to a framebuffer
+
 *==========================================================================*/
-void region_to_fb (const Region *self, FrameBuffer *fb, int x1, int y1)
+void region_clear (Region *self)
   {
   LOG_IN
-  int w_in = self->w;
-  int h_in = self->h;
-  BYTE *data = framebuffer_get_data (fb);
-  int w_out = framebuffer_get_width (fb);
-  for (int y = 0; y < h_in; y++)
-    {
-    int xp = x1;
-    int linestart24 = y * w_in;
-    int linestart32 = (y + y1) * w_out;
-    for (int x = 0; x < w_in; x++)
+  memset (self->data, 0, self->stride * self->h);
+  self->damage.count = 0;
+  self->drawn.count = 0;
+  self->flushed.count = 0;
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  region_set_gamma
+
+  Set whether pixels that a shape only partly covers are blended in 
+  linear light, which they are by default. Scratch regions for 
+  region_get_mask turn it off, so that the blend records the coverage
+  exactly, and the gamma is applied when the mask is drawn
+
+*==========================================================================*/
+void region_set_gamma (Region *self, BOOL gamma)
+  {
+  self->gamma = gamma;
+  }
+
+
+/*==========================================================================
+
+  region_set_work_pool
+
+  Set the pool whose threads do the per-frame operations in tiles, or 
+  NULL to do them on the calling thread. The result is the same either
+  way, to the byte. The region does not own the pool, which must 
+  outlive it; clones share it
+
+*==========================================================================*/
+void region_set_work_pool (Region *self, WorkPool *pool)
+  {
+  self->pool = pool;
+  }
+
+
+/*==========================================================================
+
+  region_get_mask
+
+  Cut out what has been drawn on the region since region_clear, as a
+  mask that can be drawn on any other region in any colour. The region
+  must have XRGB8888 pixels, and gamma turned off. The drawing should
+  be done in white, so that the green channel of each pixel is the 
+  coverage, which is what the mask records. Only the areas
+  recorded as drawn are examined. Returns NULL if nothing has been 
+  drawn
+
+*==========================================================================*/
+RegionMask *region_get_mask (const Region *self)
+  {
+  LOG_IN
+  RegionMask *mask = NULL;
+  if (self->format == PIXEL_FORMAT_XRGB8888 && self->drawn.count > 0)
+    {
+    RegionRect box = self->drawn.rects[0];
+    for (int i = 1; i < self->drawn.count; i++)
+      rect_union (&box, &self->drawn.rects[i]);
+
+    mask = malloc (sizeof (RegionMask));
+    mask->rows = malloc ((box.y2 - box.y1) * sizeof (MaskRow));
+    int first = -1, last = -1, size = 0;
+    for (int y = box.y1; y < box.y2; y++)
+      {
+      const uint32_t *row = (const uint32_t *)pixel_ptr (self, 0, y);
+      MaskRow *mr = &mask->rows[y - box.y1];
+      int x1 = box.x1; 
+      int x2 = box.x2;
+      while (x1 < x2 && (row[x1] & 0xFF00) == 0) x1++;
+      while (x2 > x1 && (row[x2 - 1] & 0xFF00) == 0) x2--;
+      mr->x1 = x1;
+      mr->x2 = x2;
+      mr->offset = size;
+      size += x2 - x1;
+      if (x1 < x2)
+        {
+        if (first < 0) first = y;
+        last = y;
+        }
+      }
+
+    if (first >= 0)
+      {
+      mask->data = malloc (size);
+      for (int y = first; y <= last; y++)
+        {
+        const uint32_t *row = (const uint32_t *)pixel_ptr (self, 0, y);
+        const MaskRow *mr = &mask->rows[y - box.y1];
+        BYTE *d = mask->data + mr->offset;
+        for (int x = mr->x1; x < mr->x2; x++)
+          *d++ = (row[x] >> 8) & 0xFF;
+        }
+      if (first > box.y1)
+        memmove (mask->rows, mask->rows + (first - box.y1), 
+          (last - first + 1) * sizeof (MaskRow));
+      mask->y = first;
+      mask->h = last - first + 1;
+      mask->size = sizeof (RegionMask) + mask->h * sizeof (MaskRow) + size;
+      }
+    else
       {
-      int index24 = (linestart24 + x) * BPP;
-      int index32 = (linestart32 + x + x1) * 4;
-      BYTE b = self->data [index24++];
-      BYTE g = self->data [index24++];
-      BYTE r = self->data [index24];
-      data [index32] = b;
-      data [index32+1] = g;
-      data [index32+2] = r;
-      xp++;
+      free (mask->rows);
+      free (mask);
+      mask = NULL;
       }
     }
   LOG_OUT
+  return mask;
+  }
+
+
+/*==========================================================================
+
+  region_draw_mask
+
+  Draw a mask, made by region_get_mask on a region of the same size, in
+  the specified colour. The damage is recorded in bands, like that of 
+  a line, so that a diagonal shape doesn't damage its whole bounding 
+  box. The damage depends only on the shape of the mask, so it is 
+  worked out separately from the drawing, which may be split into tiles
+
+*==========================================================================*/
+typedef struct _MaskJob
+  {
+  const RegionMask *mask;
+  uint32_t colour;
+  BYTE r, g, b;
+  } MaskJob;
+
+static void mask_tile (Region *self, const RegionRect *clip, 
+      int tile_x, void *arg)
+  {
+  const MaskJob *job = arg;
+  const RegionMask *mask = job->mask;
+  for (int y = clip->y1; y < clip->y2; y++)
+    {
+    const MaskRow *mr = &mask->rows[y - mask->y];
+    int x1 = mr->x1 > clip->x1 ? mr->x1 : clip->x1;
+    int x2 = mr->x2 < clip->x2 ? mr->x2 : clip->x2;
+    if (x1 >= x2) continue;
+    const BYTE *d = mask->data + mr->offset + (x1 - mr->x1);
+    BYTE *p = pixel_ptr (self, x1, y);
+    for (int x = x1; x < x2; x++, d++, p += self->bytes)
+      {
+      if (*d == 255)
+        store_pixel (p, self->bytes, job->colour);
+      else if (*d)
+        blend_pixel (self, p, job->colour, job->r, job->g, job->b, *d);
+      }
+    }
+  }
+
+void region_draw_mask (Region *self, const RegionMask *mask, 
+      BYTE r, BYTE g, BYTE b)
+  {
+  MaskJob job = { mask, blit_pack_pixel (self->format, r, g, b), r, g, b };
+  RegionRect box = { self->w, mask->y, 0, mask->y + mask->h };
+  if (box.y2 > self->h) box.y2 = self->h;
+  for (int y = box.y1; y < box.y2; y++)
+    {
+    const MaskRow *mr = &mask->rows[y - mask->y];
+    if (mr->x1 < mr->x2)
+      {
+      if (mr->x1 < box.x1) box.x1 = mr->x1;
+      if (mr->x2 > box.x2) box.x2 = mr->x2;
+      }
+    }
+  if (box.x2 > self->w) box.x2 = self->w;
+  run_tiles (self, self->pool, &box, mask_tile, &job);
+
+  int band_x1 = self->w, band_x2 = 0, band_y1 = mask->y;
+  for (int i = 0; i < mask->h; i++)
+    {
+    int y = mask->y + i;
+    const MaskRow *mr = &mask->rows[i];
+    if (y < self->h && mr->x1 < mr->x2)
+      {
+      int x2 = mr->x2 < self->w ? mr->x2 : self->w;
+      if (mr->x1 < band_x1) band_x1 = mr->x1;
+      if (x2 > band_x2) band_x2 = x2;
+      }
+    if (i % LINE_BAND == LINE_BAND - 1 || i == mask->h - 1)
+      {
+      region_add_damage (self, band_x1, band_y1, band_x2, y + 1);
+      band_x1 = self->w;
+      band_x2 = 0;
+      band_y1 = y + 1;
+      }
+    }
+  }
+
+
+/*==========================================================================
+  region_mask_get_size
+
+  The number of bytes of memory the mask occupies
+*==========================================================================*/
+int region_mask_get_size (const RegionMask *mask)
+  {
+  return mask->size;
+  }
+
+
+/*==========================================================================
+  region_mask_destroy
+*==========================================================================*/
+void region_mask_destroy (RegionMask *mask)
+  {
+  if (mask)
+    {
+    free (mask->data);
+    free (mask->rows);
+    free (mask);
+    }
+  }
+
+
+/*==========================================================================
+
+  clip_to_fb
+
+  Work out which part of a region placed at (x1,y1) actually falls 
+  on the framebuffer. The result is in region coordinates, with the
+  right and bottom edges excluded. Returns FALSE if nothing overlaps
+
+*==========================================================================*/
+static BOOL clip_to_fb (const Region *self, const FrameBuffer *fb, 
+      int x1, int y1, int *cx1, int *cy1, int *cx2, int *cy2)
+  {
+  *cx1 = x1 < 0 ? -x1 : 0; 
+  *cy1 = y1 < 0 ? -y1 : 0; 
+  *cx2 = self->w;
+  *cy2 = self->h;
+  int fbw = framebuffer_get_width (fb);
+  int fbh = framebuffer_get_height (fb);
+  if (x1 + *cx2 > fbw) *cx2 = fbw - x1;
+  if (y1 + *cy2 > fbh) *cy2 = fbh - y1;
+  return *cx1 < *cx2 && *cy1 < *cy2;
+  }
+
+
+/*==========================================================================
+
+  region_to_fb
+
+  Write the damaged areas of the region to the framebuffer, with the
+  region's top-left corner at (x1,y1), and mark the region undamaged. 
+  The caller is responsible for framebuffer_begin_frame and 
+  framebuffer_present. 
+  When the region was created for this framebuffer, every scanline is
+  a single memcpy. Otherwise we have to go through the row kernels,
+  via a packed BGR scanline. Any part of the region that falls outside
+  the framebuffer is skipped
+
+*==========================================================================*/
+typedef struct _ToFbJob
+  {
+  FrameBuffer *fb;
+  int x;
+  int y;
+  } ToFbJob;
+
+static void to_fb_tile (Region *self, const RegionRect *clip, 
+      int tile_x, void *arg)
+  {
+  const ToFbJob *job = arg;
+  const BlitKernels *fbk = framebuffer_get_kernels (job->fb);
+  BlitRowFn read_row = blit_get_kernels (self->format)->read_row;
+  BYTE *bgr = NULL;
+  BYTE *row = NULL;
+  if (fbk->format != self->format)
+    {
+    int n = clip->x2 - clip->x1;
+    bgr = malloc (n * 3);
+    row = malloc (n * fbk->bytes_per_pixel);
+    }
+
+  for (int i = 0; i < self->damage.count; i++)
+    {
+    RegionRect r = self->damage.rects[i];
+    if (r.x1 < clip->x1) r.x1 = clip->x1;
+    if (r.y1 < clip->y1) r.y1 = clip->y1;
+    if (r.x2 > clip->x2) r.x2 = clip->x2;
+    if (r.y2 > clip->y2) r.y2 = clip->y2;
+    if (r.x1 >= r.x2 || r.y1 >= r.y2) continue;
+
+    int n = r.x2 - r.x1;
+    const BYTE *src = pixel_ptr (self, r.x1, r.y1);
+    for (int y = r.y1; y < r.y2; y++)
+      {
+      if (bgr)
+        {
+        read_row (bgr, src, n);
+        fbk->write_row (row, bgr, n);
+        framebuffer_write_span (job->fb, job->x + r.x1, job->y + y, row, 
+          n * fbk->bytes_per_pixel);
+        }
+      else
+        framebuffer_write_span (job->fb, job->x + r.x1, job->y + y, src, 
+          n * self->bytes);
+      src += self->stride;
+      }
+    }
+  free (bgr);
+  free (row);
+  }
+
+void region_to_fb (Region *self, FrameBuffer *fb, int x1, int y1)
+  {
+  LOG_IN
+  int cx1, cy1, cx2, cy2;
+  rect_list_coalesce (&self->damage);
+  if (framebuffer_get_page_count (fb) == 2)
+    {
+    RectList this_frame = self->damage;
+    for (int i = 0; i < self->flushed.count; i++)
+      rect_list_add (&self->damage, &self->flushed.rects[i]);
+    rect_list_coalesce (&self->damage);
+    self->flushed = this_frame;
+    }
+  if (self->damage.count > 0 
+       && clip_to_fb (self, fb, x1, y1, &cx1, &cy1, &cx2, &cy2))
+    {
+    RegionRect box = rect_list_bounds (&self->damage);
+    if (box.x1 < cx1) box.x1 = cx1;
+    if (box.y1 < cy1) box.y1 = cy1;
+    if (box.x2 > cx2) box.x2 = cx2;
+    if (box.y2 > cy2) box.y2 = cy2;
+    // Deferred I/O tracks the pages written, which can only be done on
+    //   one thread
+    ToFbJob job = { fb, x1, y1 };
+    run_tiles (self, framebuffer_get_deferred_io (fb) ? NULL : self->pool,
+      &box, to_fb_tile, &job);
+    }
+  self->damage.count = 0;
+  LOG_OUT
   }
 
 
@@ -227,30 +986,55 @@ void region_to_fb (const Region *self, FrameBuffer *fb, int x1, int y1)
   region_from_fb
 
   The region should already be intialized, and have the desired
-  sizes
+  sizes. The whole region is marked as damaged. Each scanline is read 
+  with a single copy, from the framebuffer's shadow copy if it has one,
+  so that (usually uncached) framebuffer memory is read as little as
+  possible, and with the widest loads the C library can manage. Any
+  part of the region that falls outside the framebuffer is set to black
 
 *==========================================================================*/
 void region_from_fb (Region *self, const FrameBuffer *fb, int x1, int y1)
   {
   LOG_IN
-  int w_in = self->w;
-  int h_in = self->h;
-  for (int y = 0; y < h_in; y++)
-    {
-    int yp = y + y1;
-    int xp = x1;
-    int linestart = y * w_in;
-    for (int x = 0; x < w_in; x++)
+  int cx1, cy1, cx2, cy2;
+  if (!clip_to_fb (self, fb, x1, y1, &cx1, &cy1, &cx2, &cy2))
+    {
+    memset (self->data, 0, self->stride * self->h);
+    }
+  else
+    {
+    if (cx1 > 0 || cy1 > 0 || cx2 < self->w || cy2 < self->h)
+      memset (self->data, 0, self->stride * self->h);
+
+    int n = cx2 - cx1;
+    int fb_bytes = framebuffer_get_bytes_per_pixel (fb);
+    const BlitKernels *fbk = framebuffer_get_kernels (fb);
+    BYTE *dst = pixel_ptr (self, cx1, cy1);
+    if (fbk->format == self->format)
+      {
+      int row_bytes = n * self->bytes;
+      for (int y = cy1; y < cy2; y++)
+        {
+        memcpy (dst, framebuffer_read_ptr (fb, x1 + cx1, y1 + y, 
+          row_bytes), row_bytes);
+        dst += self->stride;
+        }
+      }
+    else
       {
-      BYTE r, g, b;
-      framebuffer_get_pixel (fb, xp, yp, &r, &g, &b);
-      int index24 = (linestart + x) * BPP;
-      self->data [index24++] = b;
-      self->data [index24++] = g;
-      self->data [index24] = r;
-      xp++;
+      BlitRowFn write_row = blit_get_kernels (self->format)->write_row;
+      BYTE *bgr = malloc (n * 3);
+      for (int y = cy1; y < cy2; y++)
+        {
+        fbk->read_row (bgr, framebuffer_read_ptr (fb, x1 + cx1, y1 + y, 
+          n * fb_bytes), n);
+        write_row (dst, bgr, n);
+        dst += self->stride;
+        }
+      free (bgr);
       }
     }
+  region_damage_all (self);
   LOG_OUT
   }
 
@@ -258,47 +1042,171 @@ void region_from_fb (Region *self, const FrameBuffer *fb, int x1, int y1)
 
   region_darken
 
-  Darken to the specified percentage of original value
+  Darken to the specified percentage of original value. The 32-bit 
+  layouts keep their colour in the low three bytes, and we leave the
+  alpha byte alone; the 16-bit ones have to be unpacked
 
 *==========================================================================*/
 void region_darken (Region *self, int percent)
   {
   LOG_IN
-  int l = self->w * self->h * BPP;
-  for (int i = 0; i < l; i++)
+  BYTE scale[256];
+  for (int i = 0; i < 256; i++)
+    scale[i] = i * percent / 100;
+
+  for (int y = 0; y < self->h; y++)
     {
-    self->data[i] = self->data[i] * percent / 100;
+    BYTE *p = pixel_ptr (self, 0, y);
+    if (self->bytes == 2)
+      {
+      for (int x = 0; x < self->w; x++)
+        {
+        BYTE r, g, b;
+        blit_unpack_pixel (self->format, load_pixel (p, 2), &r, &g, &b);
+        store_pixel (p, 2, blit_pack_pixel (self->format, 
+          scale[r], scale[g], scale[b]));
+        p += 2;
+        }
+      }
+    else
+      {
+      for (int x = 0; x < self->w; x++)
+        {
+        p[0] = scale[p[0]];
+        p[1] = scale[p[1]];
+        p[2] = scale[p[2]];
+        p += self->bytes;
+        }
+      }
     }
+  region_damage_all (self);
   LOG_OUT
   }
 
 /*==========================================================================
 
-  region_draw_bitmap_char
+  glyph masks
+
+  Eight pixels' worth of a glyph row at a time, as byte masks covering 
+  those pixels, for layouts with two and four bytes per pixel. Entry n 
+  selects the pixels whose bits are set in n, the first pixel being 
+  bit 0. The tables are built the first time text is drawn
 
 *==========================================================================*/
-void region_draw_bitmap_char (Region *self, const BitmapFont *bf, 
-       char c, int x, int y, int r, int g, int b)
+static uint64_t glyph_masks_2[256][2];
+static uint64_t glyph_masks_4[256][4];
+static BOOL glyph_masks_built = FALSE;
+
+static void build_glyph_masks (void)
   {
-  LOG_IN
-  if (x < self->w && y < self->h)
+  for (int n = 0; n < 256; n++)
     {
-    if (c < ' ' || c > '~') c = '?';
-    int char_offset = (c - ' ') * bf->height * 
-         (bf->width / 8 + (bf->width % 8 ? 1 : 0));
-    const uint8_t *ptr = &bf->table[char_offset];
-    for (int page = 0; page < bf->height; page++)
+    for (int i = 0; i < 8; i++)
       {
-      for (int column = 0; column < bf->width; column++)
+      if (n & (1 << i))
         {
-        if (*ptr & (0x80 >>(column % 8)))
-          region_set_pixel (self, x + column, y + page, r, g, b);
-        if (column % 8 == 7) ptr++;
+        glyph_masks_2[n][i / 4] |= (uint64_t)0xFFFF << (16 * (i % 4));
+        glyph_masks_4[n][i / 2] |= (uint64_t)0xFFFFFFFF << (32 * (i % 2));
         }
-      if (bf->width % 8 != 0) ptr++;
       }
     }
-  LOG_OUT
+  glyph_masks_built = TRUE;
+  }
+
+// Replace the bytes of the 64-bit word at p that are selected by mask
+static inline void store_masked (BYTE *p, uint64_t mask, uint64_t fill)
+  {
+  uint64_t v;
+  memcpy (&v, p, 8);
+  v = (v & ~mask) | (fill & mask);
+  memcpy (p, &v, 8);
+  }
+
+
+/*==========================================================================
+
+  draw_glyph
+
+  Draw one glyph, whose rows are as bitmap_font_get_rows expands them, 
+  with its top left corner at (x,y), clipped to the region. fill is
+  the packed colour repeated to fill 64 bits. Eight pixels are stored
+  at once, with masked word stores, when there is room for them before
+  the end of the scanline's memory; otherwise a pixel at a time
+
+*==========================================================================*/
+static void draw_glyph (Region *self, const uint32_t *rows, int height,
+      int x, int y, uint32_t colour, uint64_t fill)
+  {
+  int x1 = x < 0 ? 0 : x;
+  int shift = x1 - x;
+  if (shift >= 32 || x1 >= self->w) return;
+  int visible = self->w - x1;
+  uint32_t clip = visible >= 32 ? 0xFFFFFFFF : (1u << visible) - 1;
+  for (int i = 0; i < height; i++)
+    {
+    if (y + i < 0 || y + i >= self->h) continue;
+    uint32_t bits = (rows[i] >> shift) & clip;
+    BYTE *p = pixel_ptr (self, x1, y + i);
+    int room = self->stride - x1 * self->bytes;
+    for (; bits; bits >>= 8, p += 8 * self->bytes, room -= 8 * self->bytes)
+      {
+      int n = bits & 0xFF;
+      if (n == 0) continue;
+      if (self->bytes == 4 && room >= 32)
+        {
+        for (int j = 0; j < 4; j++)
+          if (glyph_masks_4[n][j]) 
+            store_masked (p + 8 * j, glyph_masks_4[n][j], fill);
+        }
+      else if (self->bytes == 2 && room >= 16)
+        {
+        if (n & 0x0F) store_masked (p, glyph_masks_2[n][0], fill);
+        if (n & 0xF0) store_masked (p + 8, glyph_masks_2[n][1], fill);
+        }
+      else
+        {
+        for (int j = 0; j < 8; j++)
+          if (n & (1 << j))
+            store_pixel (p + j * self->bytes, self->bytes, colour);
+        }
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  draw_spans
+
+  Draw text that has been rendered as runs of pixels by the text cache,
+  with its top left corner at (x,y), clipped to the region
+
+*==========================================================================*/
+static void draw_spans (Region *self, const TextSpan *spans, int n,
+      int x, int y, uint32_t colour)
+  {
+  for (int i = 0; i < n; i++)
+    {
+    const TextSpan *s = &spans[i];
+    int py = y + s->y;
+    if (py < 0 || py >= self->h) continue;
+    int x1 = x + s->x1 < 0 ? 0 : x + s->x1;
+    int x2 = x + s->x2 > self->w ? self->w : x + s->x2;
+    BYTE *p = pixel_ptr (self, x1, py);
+    if (self->bytes == 4)
+      {
+      for (int px = x1; px < x2; px++) ((uint32_t *)p)[px - x1] = colour;
+      }
+    else if (self->bytes == 2)
+      {
+      for (int px = x1; px < x2; px++) ((uint16_t *)p)[px - x1] = colour;
+      }
+    else
+      {
+      for (int px = x1; px < x2; px++, p += 3)
+        store_pixel (p, 3, colour);
+      }
+    }
   }
 
 
@@ -306,22 +1214,158 @@ void region_draw_bitmap_char (Region *self, const BitmapFont *bf,
 
   region_draw_bitmap_text
 
+  Characters outside the font are drawn as '?'. The text is taken from
+  the text cache if it is turned on, and drawn a glyph at a time if not
+
 *==========================================================================*/
 void region_draw_bitmap_text (Region *self, const BitmapFont *bf, 
        const char *text,
        int x, int y, int r, int g, int b)
   {
   LOG_IN
+  uint32_t colour = blit_pack_pixel (self->format, r, g, b);
   int l = strlen (text);
+  region_add_damage (self, x, y, x + l * bf->width, y + bf->height);
+
+  int n;
+  const TextSpan *spans = text_cache_get (bf, text, &n);
+  if (spans)
+    {
+    draw_spans (self, spans, n, x, y, colour);
+    LOG_OUT
+    return;
+    }
+
+  if (!glyph_masks_built) build_glyph_masks ();
+  const uint32_t *rows = bitmap_font_get_rows (bf);
+  uint64_t fill = self->bytes == 2 ? colour * 0x0001000100010001ULL
+    : colour | (uint64_t)colour << 32;
   for (int i = 0; i < l; i++)
     {
     char c = text[i];
-    region_draw_bitmap_char (self, bf, c, x + i * bf->width, y, r, g, b);
+    if (c < BITMAP_FONT_FIRST || c > BITMAP_FONT_LAST) c = '?';
+    draw_glyph (self, rows + (c - BITMAP_FONT_FIRST) * bf->height, 
+      bf->height, x + i * bf->width, y, colour, fill);
     }
   LOG_OUT
   }
 
 
+/*==========================================================================
+
+  sdf_sample_positions
+
+  For each of n output pixels along one axis of a scaled glyph, starting
+  at offset from the glyph's origin, the distance field sample before 
+  it, and how far (out of 256) it is towards the next, which always
+  exists. size is the
+  glyph's size along the axis, in font pixels, and height and 
+  font_height are the sizes the font is drawn at and made at
+
+*==========================================================================*/
+static void sdf_sample_positions (int offset, int n, int size, 
+      int height, int font_height, int *index, int *frac)
+  {
+  int last = (size + 2 * BITMAP_FONT_SDF_BORDER - 1) * 256 - 1;
+  for (int i = 0; i < n; i++)
+    {
+    // The centre of the output pixel, in 256ths of a font pixel, from
+    //   the centre of the first sample
+    int64_t g = (int64_t)(2 * (offset + i) + 1) * font_height * 128 / height
+      - 128 + BITMAP_FONT_SDF_BORDER * 256;
+    if (g < 0) g = 0;
+    if (g > last) g = last;
+    index[i] = g >> 8;
+    frac[i] = g & 0xFF;
+    }
+  }
+
+
+/*==========================================================================
+
+  region_draw_scaled_text
+
+  Draw text in a bitmap font, scaled to be height pixels high, using 
+  the font's signed distance fields. Each pixel's distance from the 
+  edge of the glyph is interpolated from the four nearest samples, and
+  converted to the fraction of the pixel that the glyph covers, which
+  is blended like the edge of any other shape. Characters outside the 
+  font are drawn as '?'
+
+*==========================================================================*/
+void region_draw_scaled_text (Region *self, const BitmapFont *bf, 
+       const char *text, int x, int y, int height, int r, int g, int b)
+  {
+  LOG_IN
+  const BYTE *sdf = bitmap_font_get_sdf (bf);
+  const int border = BITMAP_FONT_SDF_BORDER;
+  int gw = bf->width + 2 * border;
+  int gh = bf->height + 2 * border;
+  int width = bf->width * height / bf->height;
+  int l = strlen (text);
+
+  // The area around each glyph that its field covers, relative to its
+  //   origin
+  int ox1 = -border * height / bf->height - 1;
+  int ox2 = (bf->width + border) * height / bf->height + 1;
+  int oy1 = ox1;
+  int oy2 = (bf->height + border) * height / bf->height + 1;
+  int *cols = malloc (2 * (ox2 - ox1 + oy2 - oy1) * sizeof (int));
+  int *col_frac = cols + (ox2 - ox1);
+  int *rows = col_frac + (ox2 - ox1);
+  int *row_frac = rows + (oy2 - oy1);
+  sdf_sample_positions (ox1, ox2 - ox1, bf->width, height, bf->height, 
+    cols, col_frac);
+  sdf_sample_positions (oy1, oy2 - oy1, bf->height, height, bf->height, 
+    rows, row_frac);
+
+  // Interpolated distances are in 65536ths of a field step; this 
+  //   converts them to 255ths of an output pixel, in 1 << 24 units
+  int64_t k = (int64_t)255 * height * 256 
+    / (BITMAP_FONT_SDF_ONE * bf->height);
+
+  uint32_t colour = blit_pack_pixel (self->format, r, g, b);
+  int y1 = y + oy1 < 0 ? 0 : y + oy1;
+  int y2 = y + oy2 > self->h ? self->h : y + oy2;
+  for (int i = 0; i < l; i++)
+    {
+    char c = text[i];
+    if (c < BITMAP_FONT_FIRST || c > BITMAP_FONT_LAST) c = '?';
+    const BYTE *field = sdf + (c - BITMAP_FONT_FIRST) * gw * gh;
+    int gx = x + i * width;
+    int x1 = gx + ox1 < 0 ? 0 : gx + ox1;
+    int x2 = gx + ox2 > self->w ? self->w : gx + ox2;
+    if (x1 >= x2 || y1 >= y2) continue;
+    region_add_damage (self, x1, y1, x2, y2);
+    for (int py = y1; py < y2; py++)
+      {
+      int ry = py - y - oy1;
+      const BYTE *s0 = field + rows[ry] * gw;
+      const BYTE *s1 = s0 + gw;
+      int fy = row_frac[ry];
+      BYTE *p = pixel_ptr (self, x1, py);
+      for (int px = x1; px < x2; px++, p += self->bytes)
+        {
+        int rx = px - gx - ox1;
+        int sx = cols[rx];
+        int fx = col_frac[rx];
+        int top = s0[sx] * (256 - fx) + s0[sx + 1] * fx;
+        int bottom = s1[sx] * (256 - fx) + s1[sx + 1] * fx;
+        int d = top * (256 - fy) + bottom * fy - (128 << 16);
+        int a = (int)(((int64_t)d * k) >> 24) + 128;
+        if (a <= 0) continue;
+        if (a >= 255)
+          store_pixel (p, self->bytes, colour);
+        else
+          blend_pixel (self, p, colour, r, g, b, a);
+        }
+      }
+    }
+  free (cols);
+  LOG_OUT
+  }
+
+
 /*==========================================================================
   region_get_width
 *==========================================================================*/
@@ -342,7 +1386,18 @@ int region_get_height (const Region *self)
 /*==========================================================================
   
   region_draw_line_one_pixel
-  https://en.wikipedia.org/wiki/Xiaolin_Wu%27s_line_algorithm
+
+  Draw an anti-aliased line, using Xiaolin Wu's algorithm
+  (https://en.wikipedia.org/wiki/Xiaolin_Wu%27s_line_algorithm). For
+  each step along the major axis, the two pixels either side of the
+  ideal line are blended with the colour, in proportion to how close
+  they are to it. The end points are whole pixels, so they need no
+  special treatment. 
+
+  The line is clipped to the region once, before drawing, and stepped
+  in 16.16 fixed point, so there is no per-pixel floating point or 
+  bounds checking. Pixels are addressed from the start of the row,
+  or column, being drawn
 
 *==========================================================================*/
 void region_draw_line_one_pixel (Region *self, int x0, int y0, 
@@ -350,8 +1405,11 @@ void region_draw_line_one_pixel (Region *self, int x0, int y0,
   {
   LOG_IN
 
-  BOOL steep = absolute (y1 - y0) > absolute (x1 - x0); 
-  
+  add_line_damage (self, x0, y0, x1, y1);
+
+  // Work along the major axis, called x here, from left to right.
+  //   major and minor are the pixel steps along each axis in memory
+  BOOL steep = abs (y1 - y0) > abs (x1 - x0); 
   if (steep) 
     { 
     swap (&x0, &y0); 
@@ -362,67 +1420,60 @@ void region_draw_line_one_pixel (Region *self, int x0, int y0,
     swap (&x0, &x1); 
     swap (&y0, &y1); 
     } 
-  
-  float dx = x1 - x0; 
-  float dy = y1 - y0; 
-  float gradient = dy / dx; 
-  if (dx == 0.0) 
-    gradient = 1; 
-
-  float xend = rnd (x0);
-  float yend = y0 + gradient * (xend - x0);
-  float xgap = rfpart (x0 + 0.5);
-  int xpxl1 = xend;
-  int ypxl1 = ipart (yend);
-  if (steep)
-    {
-    region_set_pixel_t (self, ypxl1, xpxl1, r, g, b, rfpart (yend) * xgap);
-    region_set_pixel_t (self, ypxl1 + 1, xpxl1, r, g, b, fpart(yend) * xgap); 
-    }
-  else
-    {
-    region_set_pixel_t (self, xpxl1, ypxl1, r, g, b, rfpart(yend) * xgap);
-    region_set_pixel_t (self, xpxl1, ypxl1 + 1, r, g, b, fpart(yend) * xgap);
-    }
+  int xlimit = steep ? self->h : self->w;
+  int ylimit = steep ? self->w : self->h;
+  int major = steep ? self->stride : self->bytes;
+  int minor = steep ? self->bytes : self->stride;
 
-  float intersectY = yend + gradient; 
+  int dx = x1 - x0; 
+  int32_t gradient = dx == 0 ? 0 : (int32_t)((int64_t)(y1 - y0) * 65536 / dx);
+  int64_t ystart = (int64_t)y0 * 65536;
 
-  xend = rnd (x1);
-  yend = y1 + gradient * (xend - x1);
-  xgap = rfpart (x1 + 0.5);
-  int xpxl2 = xend;
-  int ypxl2 = ipart (yend);
-  if (steep)
+  // Clip along the major axis, and then to the x values for which y 
+  //   falls in the region. At the very edge, the faint second pixel of
+  //   a pair can be lost
+  int xa = x0 < 0 ? 0 : x0;
+  int xb = x1 >= xlimit ? xlimit - 1 : x1;
+  int64_t ymax = (int64_t)(ylimit - 1) << 16;
+  if (gradient == 0 || (gradient > 0 && ystart > ymax) 
+       || (gradient < 0 && ystart < 0))
     {
-    region_set_pixel_t (self, ypxl2, xpxl2, r, g, b, rfpart (yend) * xgap);
-    region_set_pixel_t (self, ypxl2 + 1, xpxl2, r, g, b, fpart(yend) * xgap); 
+    // Either horizontal, or heading away from the region
+    if (ystart < 0 || ystart > ymax) xb = xa - 1;
     }
   else
     {
-    region_set_pixel_t (self, xpxl2, ypxl2, r, g, b, rfpart(yend) * xgap);
-    region_set_pixel_t (self, xpxl2, ypxl2 + 1, r, g, b, fpart(yend) * xgap);
+    // x at which y is 0, and at which it is ymax, rounded inwards
+    int64_t xlo, xhi;
+    if (gradient > 0)
+      {
+      xlo = x0 + (-ystart + gradient - 1) / gradient;
+      xhi = x0 + (ymax - ystart) / gradient;
+      if (ystart >= 0) xlo = x0;
+      }
+    else
+      {
+      xlo = x0 + (ystart - ymax + (-gradient) - 1) / (-gradient);
+      xhi = x0 + ystart / (-gradient);
+      if (ystart <= ymax) xlo = x0;
+      }
+    if (xlo > xa) xa = xlo;
+    if (xhi < xb) xb = xhi;
     }
 
-   if (steep) 
-    { 
-    for (int x = xpxl1 ; x <=xpxl2 ; x++) 
-      { 
-      float t1 = rfpart (intersectY);
-      float t2 = fpart (intersectY);
-      region_set_pixel_t (self, ipart (intersectY), x, r, g, b, t1); 
-      region_set_pixel_t (self, ipart (intersectY) + 1, x, r, g, b, t2);
-      intersectY += gradient; 
-      } 
-    } 
-  else
+  uint32_t colour = blit_pack_pixel (self->format, r, g, b);
+  int32_t y = (int32_t)(ystart + (int64_t)gradient * (xa - x0));
+  BYTE *line = self->data + (int64_t)xa * major;
+  for (int x = xa; x <= xb; x++, y += gradient, line += major)
     {
-    for (int x = xpxl1 ; x <=xpxl2 ; x++) 
-      { 
-      float t1 = rfpart (intersectY);
-      float t2 = fpart (intersectY);
-      region_set_pixel_t (self, x, ipart (intersectY), r, g, b, t1); 
-      region_set_pixel_t (self, x, ipart (intersectY) + 1, r, g, b, t2);
-      intersectY += gradient; 
+    BYTE *p = line + (y >> 16) * minor;
+    int frac = (y >> 8) & 0xFF;
+    if (frac == 0)
+      store_pixel (p, self->bytes, colour);
+    else
+      {
+      blend_pixel (self, p, colour, r, g, b, 255 - frac);
+      blend_pixel (self, p + minor, colour, r, g, b, frac);
       }
     }
   LOG_OUT
@@ -447,13 +1498,18 @@ void region_draw_hollow_line (Region *self, int x1, int y1, int x2, int y2,
     }
   else
     {
-    double theta = atan2 (y2 - y1, x2 - x1); 
-    double q = HALFPI - theta;
+    // The sides are offset from the centre line along its normal. 
+    //   Positions are worked out in fixed point, and rounded
+    int theta = trig_atan2 (y2 - y1, x2 - x1); 
+    int q = TRIG_STEPS / 4 - theta;
+    int32_t cq = trig_cos (q);
+    int32_t sq = trig_sin (q);
+    int32_t half = TRIG_ONE / 2;
 
     int i = 0;
     int d = i - t / 2; 
-    int nx1 = (int) (x1 - (cos (q) * d) + 0.5);
-    int ny1 = (int) (y1 + (sin (q) * d) + 0.5);
+    int nx1 = ((x1 << TRIG_SHIFT) - cq * d + half) >> TRIG_SHIFT;
+    int ny1 = ((y1 << TRIG_SHIFT) + sq * d + half) >> TRIG_SHIFT;
 
     int p1x = nx1;
     int p1y = ny1;
@@ -462,8 +1518,8 @@ void region_draw_hollow_line (Region *self, int x1, int y1, int x2, int y2,
 
     i = t - 1;
     d = i - t / 2; 
-    nx1 = (int) (x1 - (0.5 * cos (q) * d) + 0.5);
-    ny1 = (int) (y1 + (0.5 * sin (q) * d) + 0.5);
+    nx1 = ((x1 << TRIG_SHIFT) - cq * d / 2 + half) >> TRIG_SHIFT;
+    ny1 = ((y1 << TRIG_SHIFT) + sq * d / 2 + half) >> TRIG_SHIFT;
 
     int p3x = nx1;
     int p3y = ny1;
@@ -478,3 +1534,244 @@ void region_draw_hollow_line (Region *self, int x1, int y1, int x2, int y2,
   }
 
 
+/*==========================================================================
+
+  polygon_add_cells
+
+  Add the area to the right of one edge, within one scanline, to the
+  accumulation buffer row. The edge runs from xa to xb (in subpixels,
+  relative to the start of the row), and covers d subpixels vertically,
+  negative for edges that run upwards. Each cell gets the part of the
+  area that falls in it, and the cell to its right gets the rest; the
+  running sum along the row carries that on to the right edge. Areas
+  are in units of half a square subpixel, so that edge midpoints are
+  whole numbers.
+
+  The buffer row may hold only some of the cells: cell first is at 
+  row[0], and there are n. Cells to the left of first are added to 
+  row[0], which is all the running sum needs of them, and cells beyond 
+  the end are dropped
+
+*==========================================================================*/
+static inline void add_cell (int32_t *row, int i, int n, int32_t v)
+  {
+  if (i < n) row[i < 0 ? 0 : i] += v;
+  }
+
+static void polygon_add_cells (int32_t *row, int first, int n, 
+      int xa, int xb, int d)
+  {
+  int xl = xa < xb ? xa : xb;
+  int xr = xa < xb ? xb : xa;
+  int i = xl / REGION_SUBPIXEL;
+  int cell = i * REGION_SUBPIXEL;
+  if (xr <= cell + REGION_SUBPIXEL)
+    {
+    int xm2 = xl + xr - 2 * cell;
+    add_cell (row, i - first, n, d * (2 * REGION_SUBPIXEL - xm2));
+    add_cell (row, i + 1 - first, n, d * xm2);
+    }
+  else
+    {
+    // The edge crosses several cells. Each piece's share of d is in
+    //   proportion to its width, and the shares are worked out from the
+    //   running total, so that they add up to d exactly
+    int span = xr - xl;
+    int prev = 0;
+    int xs = xl;
+    while (xs < xr)
+      {
+      int xe = cell + REGION_SUBPIXEL < xr ? cell + REGION_SUBPIXEL : xr;
+      int cum = (int)((int64_t)d * (xe - xl) / span);
+      int dp = cum - prev;
+      int xm2 = xs + xe - 2 * cell;
+      add_cell (row, i - first, n, dp * (2 * REGION_SUBPIXEL - xm2));
+      add_cell (row, i + 1 - first, n, dp * xm2);
+      prev = cum;
+      xs = xe;
+      i++;
+      cell += REGION_SUBPIXEL;
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  region_fill_polygon
+
+  Fill a convex polygon, anti-aliased by the exact area of each pixel
+  that it covers, and blend it with what is already there. The n 
+  vertices are x,y pairs in points, in units of 1/REGION_SUBPIXEL of a
+  pixel; pixel (x,y) is the square from (x,y) to (x+1,y+1). The damage
+  is recorded in bands, like that of a line.
+
+  Each edge adds its signed area to an accumulation buffer, a scanline
+  at a time, and a running sum along each row then gives the coverage
+  of each pixel. This is the approach taken by font-rs, done here in 
+  integers. Scanlines are independent, and the running sum can start
+  part way along a row, so the polygon can be drawn in tiles, each with
+  a buffer just big enough for itself. Each tile notes the extent of
+  the pixels it covered in each row, and the damage is worked out from
+  those afterwards
+
+*==========================================================================*/
+typedef struct _PolygonJob
+  {
+  const int *points;
+  int n;
+  uint32_t colour;
+  BYTE r, g, b;
+  // The bounding box, in pixels
+  RegionRect box;
+  // For each tile column, the extent of the covered pixels in each row
+  //   of the bounding box
+  int *row_x1;
+  int *row_x2;
+  } PolygonJob;
+
+static void polygon_tile (Region *self, const RegionRect *clip, 
+      int tile_x, void *arg)
+  {
+  const PolygonJob *job = arg;
+  const int *points = job->points;
+  int bx1 = job->box.x1;
+  int box_h = job->box.y2 - job->box.y1;
+  int *row_x1 = job->row_x1 + tile_x * box_h - job->box.y1;
+  int *row_x2 = job->row_x2 + tile_x * box_h - job->box.y1;
+
+  // Each row has a spare cell, for the area to the right of the last 
+  //   pixel
+  int first = clip->x1 - bx1;
+  int aw = clip->x2 - clip->x1 + 1;
+  int32_t *acc = calloc (aw * (clip->y2 - clip->y1), sizeof (int32_t));
+  int xmax = (job->box.x2 - bx1) * REGION_SUBPIXEL;
+  int ytop = clip->y1 * REGION_SUBPIXEL;
+  int ybot = clip->y2 * REGION_SUBPIXEL;
+
+  for (int i = 0; i < job->n; i++)
+    {
+    int x0 = points[2 * i], y0 = points[2 * i + 1];
+    int j = (i + 1) % job->n;
+    int x1 = points[2 * j], y1 = points[2 * j + 1];
+    if (y0 == y1) continue;
+    int dir = 1;
+    if (y0 > y1)
+      {
+      swap (&x0, &x1);
+      swap (&y0, &y1);
+      dir = -1;
+      }
+    int64_t dxe = x1 - x0;
+    int64_t dye = y1 - y0;
+    int ys = y0 > ytop ? y0 : ytop;
+    int ye = y1 < ybot ? y1 : ybot;
+    for (int row = ys / REGION_SUBPIXEL; row * REGION_SUBPIXEL < ye; row++)
+      {
+      int t = row * REGION_SUBPIXEL > ys ? row * REGION_SUBPIXEL : ys;
+      int u = (row + 1) * REGION_SUBPIXEL < ye 
+        ? (row + 1) * REGION_SUBPIXEL : ye;
+      if (u <= t) continue;
+      int xa = x0 + dxe * (t - y0) / dye - bx1 * REGION_SUBPIXEL;
+      int xb = x0 + dxe * (u - y0) / dye - bx1 * REGION_SUBPIXEL;
+      xa = xa < 0 ? 0 : (xa > xmax ? xmax : xa);
+      xb = xb < 0 ? 0 : (xb > xmax ? xmax : xb);
+      polygon_add_cells (acc + (row - clip->y1) * aw, first, aw, 
+        xa, xb, (u - t) * dir);
+      }
+    }
+
+  // A pixel that is completely covered has this area
+  const int32_t full = 2 * REGION_SUBPIXEL * REGION_SUBPIXEL;
+  for (int y = clip->y1; y < clip->y2; y++)
+    {
+    const int32_t *row = acc + (y - clip->y1) * aw;
+    BYTE *p = pixel_ptr (self, clip->x1, y);
+    int32_t sum = 0;
+    for (int x = clip->x1; x < clip->x2; x++, p += self->bytes)
+      {
+      sum += row[x - clip->x1];
+      int32_t cov = sum < 0 ? -sum : sum;
+      int a = cov >= full ? 255 : (cov * 255 + full / 2) / full;
+      if (a == 0) continue;
+      if (x < row_x1[y]) row_x1[y] = x;
+      if (x >= row_x2[y]) row_x2[y] = x + 1;
+      if (a == 255)
+        store_pixel (p, self->bytes, job->colour);
+      else
+        blend_pixel (self, p, job->colour, job->r, job->g, job->b, a);
+      }
+    }
+  free (acc);
+  }
+
+void region_fill_polygon (Region *self, const int *points, int n, 
+      BYTE r, BYTE g, BYTE b)
+  {
+  LOG_IN
+  int minx = points[0], maxx = points[0];
+  int miny = points[1], maxy = points[1];
+  for (int i = 1; i < n; i++)
+    {
+    int px = points[2 * i], py = points[2 * i + 1];
+    if (px < minx) minx = px;
+    if (px > maxx) maxx = px;
+    if (py < miny) miny = py;
+    if (py > maxy) maxy = py;
+    }
+
+  // The bounding box in pixels, clipped to the region. Coordinates are
+  //   clamped to be non-negative before dividing, so that division 
+  //   rounds down
+  PolygonJob job;
+  RegionRect *box = &job.box;
+  box->x1 = minx < 0 ? 0 : minx / REGION_SUBPIXEL;
+  box->y1 = miny < 0 ? 0 : miny / REGION_SUBPIXEL;
+  box->x2 = maxx < 0 ? 0 : (maxx + REGION_SUBPIXEL - 1) / REGION_SUBPIXEL;
+  box->y2 = maxy < 0 ? 0 : (maxy + REGION_SUBPIXEL - 1) / REGION_SUBPIXEL;
+  if (box->x2 > self->w) box->x2 = self->w;
+  if (box->y2 > self->h) box->y2 = self->h;
+  if (box->x1 >= box->x2 || box->y1 >= box->y2) 
+    {
+    LOG_OUT
+    return;
+    }
+
+  job.points = points;
+  job.n = n;
+  job.colour = blit_pack_pixel (self->format, r, g, b);
+  job.r = r;
+  job.g = g;
+  job.b = b;
+  int across = tiles_across (self->pool, box);
+  int box_h = box->y2 - box->y1;
+  job.row_x1 = malloc (2 * across * box_h * sizeof (int));
+  job.row_x2 = job.row_x1 + across * box_h;
+  for (int i = 0; i < across * box_h; i++)
+    {
+    job.row_x1[i] = self->w;
+    job.row_x2[i] = 0;
+    }
+  run_tiles (self, self->pool, box, polygon_tile, &job);
+
+  int band_x1 = self->w, band_x2 = 0, band_y1 = box->y1;
+  for (int y = box->y1; y < box->y2; y++)
+    {
+    for (int t = 0; t < across; t++)
+      {
+      int i = t * box_h + y - box->y1;
+      if (job.row_x1[i] < band_x1) band_x1 = job.row_x1[i];
+      if (job.row_x2[i] > band_x2) band_x2 = job.row_x2[i];
+      }
+    if ((y - box->y1) % LINE_BAND == LINE_BAND - 1 || y == box->y2 - 1)
+      {
+      region_add_damage (self, band_x1, band_y1, band_x2, y + 1);
+      band_x1 = self->w;
+      band_x2 = 0;
+      band_y1 = y + 1;
+      }
+    }
+  free (job.row_x1);
+  LOG_OUT
+  }
+
@@ -11,24 +11,45 @@
 #include "defs.h"
 #include "bitmap_font.h"
 #include "framebuffer.h"
+#include "workpool.h"
 
 struct _Region;
 typedef struct _Region Region;
 
+// Polygon vertices are given in fractions of a pixel
+#define REGION_SUBPIXEL 256
+
+struct _RegionMask;
+typedef struct _RegionMask RegionMask;
+
+// A rectangle in region coordinates. x2 and y2 are excluded
+typedef struct _RegionRect
+  {
+  int x1;
+  int y1;
+  int x2;
+  int y2;
+  } RegionRect;
+
 BEGIN_DECLS
 
 Region     *region_create (int w, int h);
+Region     *region_create_with_format (int w, int h, PixelFormat format);
+Region     *region_create_for_fb (const FrameBuffer *fb, int w, int h);
 void        region_set_pixel (Region *self, int x, int y, 
                BYTE r, BYTE g, BYTE b);
 void        region_fill_rect (Region *self, int x1, int y1,
                int x2, int y2, BYTE r, BYTE g, BYTE b);
 void        region_destroy (Region *self);
-void        region_to_fb (const Region *r, FrameBuffer *fb, int x, int y);
+void        region_to_fb (Region *r, FrameBuffer *fb, int x, int y);
 void        region_from_fb (Region *self, const FrameBuffer *fb, int x, int y);
 void        region_darken (Region *self, int percent);
 void        region_draw_bitmap_text (Region *self, const BitmapFont *bf,
                const char *text,  
                int x, int y, int r, int g, int b);
+void        region_draw_scaled_text (Region *self, const BitmapFont *bf,
+               const char *text, int x, int y, int height, 
+               int r, int g, int b);
 Region     *region_clone (const Region *other);
 int         region_get_height (const Region *self);
 int         region_get_width (const Region *self);
@@ -36,6 +57,22 @@ void        region_draw_line_one_pixel (Region *self, int x1, int x2,
                int y1, int y2, BYTE r, BYTE g, BYTE b);
 void        region_draw_hollow_line (Region *self, int x1, int x2, 
                int y1, int y2, int thickness, BYTE r, BYTE g, BYTE b);
+void        region_fill_polygon (Region *self, const int *points, int n,
+               BYTE r, BYTE g, BYTE b);
+void        region_add_damage (Region *self, int x1, int y1, 
+               int x2, int y2);
+void        region_damage_all (Region *self);
+int         region_get_damage_count (const Region *self);
+const RegionRect *region_get_damage (const Region *self, int i);
+void        region_revert (Region *self, const Region *bg);
+void        region_clear (Region *self);
+void        region_set_gamma (Region *self, BOOL gamma);
+void        region_set_work_pool (Region *self, WorkPool *pool);
+RegionMask *region_get_mask (const Region *self);
+void        region_draw_mask (Region *self, const RegionMask *mask,
+               BYTE r, BYTE g, BYTE b);
+int         region_mask_get_size (const RegionMask *mask);
+void        region_mask_destroy (RegionMask *mask);
 END_DECLS
 
 
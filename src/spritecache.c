@@ -0,0 +1,212 @@
+/*============================================================================
+
+  fbclock
+  spritecache.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A cache of anti-aliased shapes, like the clock hands at each of 
+  their positions, stored as masks so that they can be drawn without
+  being rasterized again. Each sprite is identified by an integer key,
+  chosen by the caller, and drawn by the caller's render function the
+  first time it is needed. The masks for all the sprites together are
+  kept within a memory budget; when a new one won't fit, the ones that
+  have gone unused longest are thrown away.
+
+  A cache serves regions of one particular size, since sprites are 
+  drawn at fixed positions within the region.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "defs.h"
+#include "log.h"
+#include "region.h"
+#include "stats.h"
+#include "spritecache.h"
+
+typedef struct _Sprite
+  {
+  int key;
+  RegionMask *mask;
+  int64_t last_used;
+  } Sprite;
+
+struct _SpriteCache
+  {
+  int w;
+  int h;
+  long budget;
+  long used;
+  // Sprites are looked up by a linear search. There are fewer than a
+  //   thousand, even with all the hands at all their positions, and
+  //   only three lookups a frame
+  Sprite *sprites;
+  int count;
+  int capacity;
+  int64_t clock;
+  // The region that sprites are rendered on, before being cut out 
+  Region *scratch;
+  };
+
+
+/*==========================================================================
+  sprite_cache_create
+
+  budget is the most memory, in bytes, that the masks may occupy
+*==========================================================================*/
+SpriteCache *sprite_cache_create (int w, int h, long budget)
+  {
+  LOG_IN
+  SpriteCache *self = malloc (sizeof (SpriteCache));
+  self->w = w;
+  self->h = h;
+  self->budget = budget;
+  self->used = 0;
+  self->sprites = NULL;
+  self->count = 0;
+  self->capacity = 0;
+  self->clock = 0;
+  self->scratch = NULL;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  sprite_cache_destroy
+*==========================================================================*/
+void sprite_cache_destroy (SpriteCache *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    for (int i = 0; i < self->count; i++)
+      region_mask_destroy (self->sprites[i].mask);
+    stats_add ("sprites.bytes", -self->used);
+    free (self->sprites);
+    region_destroy (self->scratch);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  sprite_cache_evict
+
+  Throw away the least recently used sprites until there is room for
+  size more bytes
+
+*==========================================================================*/
+static void sprite_cache_evict (SpriteCache *self, long size)
+  {
+  while (self->count > 0 && self->used + size > self->budget)
+    {
+    int oldest = 0;
+    for (int i = 1; i < self->count; i++)
+      {
+      if (self->sprites[i].last_used < self->sprites[oldest].last_used)
+        oldest = i;
+      }
+    int n = region_mask_get_size (self->sprites[oldest].mask);
+    region_mask_destroy (self->sprites[oldest].mask);
+    self->sprites[oldest] = self->sprites[--self->count];
+    self->used -= n;
+    stats_add ("sprites.bytes", -n);
+    stats_add ("sprites.evictions", 1);
+    }
+  }
+
+
+/*==========================================================================
+
+  sprite_cache_build
+
+  Render a sprite on the scratch region, and cut it out. Returns NULL
+  if it doesn't fit in the budget, or there is nothing to draw
+
+*==========================================================================*/
+static Sprite *sprite_cache_build (SpriteCache *self, int key, 
+      SpriteRenderFn render, const void *arg)
+  {
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  if (!self->scratch)
+    {
+    self->scratch = region_create_with_format (self->w, self->h, 
+      PIXEL_FORMAT_XRGB8888);
+    region_set_gamma (self->scratch, FALSE);
+    }
+  region_clear (self->scratch);
+  render (self->scratch, arg, 255, 255, 255);
+  RegionMask *mask = region_get_mask (self->scratch);
+
+  Sprite *sprite = NULL;
+  if (mask && region_mask_get_size (mask) <= self->budget)
+    {
+    int n = region_mask_get_size (mask);
+    sprite_cache_evict (self, n);
+    if (self->count == self->capacity)
+      {
+      self->capacity = self->capacity ? self->capacity * 2 : 64;
+      self->sprites = realloc (self->sprites, 
+        self->capacity * sizeof (Sprite));
+      }
+    sprite = &self->sprites[self->count++];
+    sprite->key = key;
+    sprite->mask = mask;
+    self->used += n;
+    stats_add ("sprites.bytes", n);
+    }
+  else
+    region_mask_destroy (mask);
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  stats_add ("sprites.build_usec", (end.tv_sec - start.tv_sec) * 1000000 
+    + (end.tv_nsec - start.tv_nsec) / 1000);
+  return sprite;
+  }
+
+
+/*==========================================================================
+
+  sprite_cache_draw
+
+  Draw the sprite with the specified key on target, which must be the
+  size this cache was created for. If it isn't in the cache, it is
+  drawn by render, and then cached, if that is possible
+
+*==========================================================================*/
+void sprite_cache_draw (SpriteCache *self, Region *target, int key, 
+      SpriteRenderFn render, const void *arg, BYTE cr, BYTE cg, BYTE cb)
+  {
+  Sprite *sprite = NULL;
+  for (int i = 0; i < self->count && !sprite; i++)
+    {
+    if (self->sprites[i].key == key)
+      sprite = &self->sprites[i];
+    }
+
+  if (sprite)
+    stats_add ("sprites.hits", 1);
+  else
+    {
+    stats_add ("sprites.misses", 1);
+    sprite = sprite_cache_build (self, key, render, arg);
+    }
+
+  if (sprite)
+    {
+    sprite->last_used = ++self->clock;
+    region_draw_mask (target, sprite->mask, cr, cg, cb);
+    }
+  else
+    render (target, arg, cr, cg, cb);
+  }
+
@@ -0,0 +1,31 @@
+/*============================================================================
+
+  fbclock
+  spritecache.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "region.h"
+
+struct _SpriteCache;
+typedef struct _SpriteCache SpriteCache;
+
+// Draw a sprite on r, in the specified colour. arg is whatever was 
+//   passed to sprite_cache_draw
+typedef void (*SpriteRenderFn) (Region *r, const void *arg, 
+                 BYTE cr, BYTE cg, BYTE cb);
+
+BEGIN_DECLS
+
+SpriteCache *sprite_cache_create (int w, int h, long budget);
+void         sprite_cache_destroy (SpriteCache *self);
+void         sprite_cache_draw (SpriteCache *self, Region *target, 
+                int key, SpriteRenderFn render, const void *arg,
+                BYTE cr, BYTE cg, BYTE cb);
+
+END_DECLS
+
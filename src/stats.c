@@ -0,0 +1,106 @@
+/*============================================================================
+
+  fbclock
+  stats.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A set of named counters, that the various parts of the program update
+  as they run, and which can be written to the log on demand (fbclock
+  does this when it receives SIGUSR1). Names are compared as strings,
+  so callers should not update counters in per-pixel loops. A name is
+  copied the first time it is used, so it can be made up on the fly --
+  for a counter that is kept for each output, say.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "defs.h"
+#include "log.h"
+#include "stats.h"
+
+#define MAX_STATS 128
+
+typedef struct _Stat
+  {
+  char *name;
+  int64_t value;
+  } Stat;
+
+static Stat stats[MAX_STATS];
+static int nstats = 0;
+
+
+/*==========================================================================
+
+  stats_find
+
+  Find the named counter, creating it if necessary. Returns NULL only if
+  the table is full
+
+*==========================================================================*/
+static Stat *stats_find (const char *name)
+  {
+  for (int i = 0; i < nstats; i++)
+    {
+    if (strcmp (stats[i].name, name) == 0)
+      return &stats[i];
+    }
+  if (nstats < MAX_STATS)
+    {
+    stats[nstats].name = strdup (name);
+    stats[nstats].value = 0;
+    return &stats[nstats++];
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+  stats_set
+*==========================================================================*/
+void stats_set (const char *name, int64_t value)
+  {
+  Stat *s = stats_find (name);
+  if (s) s->value = value;
+  }
+
+
+/*==========================================================================
+  stats_add
+*==========================================================================*/
+void stats_add (const char *name, int64_t delta)
+  {
+  Stat *s = stats_find (name);
+  if (s) s->value += delta;
+  }
+
+
+/*==========================================================================
+  stats_get
+*==========================================================================*/
+int64_t stats_get (const char *name)
+  {
+  Stat *s = stats_find (name);
+  return s ? s->value : 0;
+  }
+
+
+/*==========================================================================
+  stats_log
+
+  Write all the counters to the log, at info level, in the order they
+  were first used
+
+*==========================================================================*/
+void stats_log (void)
+  {
+  LOG_IN
+  for (int i = 0; i < nstats; i++)
+    log_info ("stats: %s = %" PRId64, stats[i].name, stats[i].value);
+  LOG_OUT
+  }
+
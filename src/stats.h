@@ -0,0 +1,21 @@
+/*============================================================================
+
+  fbclock
+  stats.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+BEGIN_DECLS
+
+void     stats_set (const char *name, int64_t value);
+void     stats_add (const char *name, int64_t delta);
+int64_t  stats_get (const char *name);
+void     stats_log (void);
+
+END_DECLS
+
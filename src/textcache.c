@@ -0,0 +1,217 @@
+/*============================================================================
+
+  fbclock
+  textcache.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A cache of strings already rendered in a bitmap font, so that labels
+  that are drawn over and over -- the numerals, the date -- are not
+  put together a glyph at a time each time. A rendered string is a
+  list of the horizontal runs of pixels it covers. The fonts are not
+  anti-aliased, so the runs are the whole of its mask, and the same 
+  runs serve for any colour. The strings are kept within a memory 
+  budget; when a new one won't fit, the ones that have gone unused 
+  longest are thrown away.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "log.h"
+#include "stats.h"
+#include "bitmap_font.h"
+#include "textcache.h"
+
+typedef struct _TextEntry
+  {
+  const BitmapFont *font;
+  char *text;
+  TextSpan *spans;
+  int n_spans;
+  long size;
+  int64_t last_used;
+  } TextEntry;
+
+// Entries are looked up by a linear search; a clock has a dozen or so
+//   labels
+static TextEntry *entries = NULL;
+static int count = 0;
+static int capacity = 0;
+static long budget = 0;
+static long used = 0;
+static int64_t ticks = 0;
+
+
+/*==========================================================================
+
+  text_cache_set_budget
+
+  Set the most memory, in bytes, that the cached strings may take. Zero
+  turns off the cache. This has to be called before anything is drawn
+
+*==========================================================================*/
+void text_cache_set_budget (long b)
+  {
+  budget = b;
+  }
+
+
+/*==========================================================================
+
+  text_cache_render
+
+  Work out the runs of pixels that text covers, in the font. The 
+  result is allocated, and *n is set to the number of runs
+
+*==========================================================================*/
+static TextSpan *text_cache_render (const BitmapFont *bf, 
+      const char *text, int *n)
+  {
+  const uint32_t *rows = bitmap_font_get_rows (bf);
+  int l = strlen (text);
+  int width = l * bf->width;
+  int max = 0;
+  TextSpan *spans = NULL;
+  *n = 0;
+  for (int y = 0; y < bf->height; y++)
+    {
+    int start = -1;
+    for (int x = 0; x <= width; x++)
+      {
+      BOOL ink = FALSE;
+      if (x < width)
+        {
+        char c = text[x / bf->width];
+        if (c < BITMAP_FONT_FIRST || c > BITMAP_FONT_LAST) c = '?';
+        uint32_t bits = rows[(c - BITMAP_FONT_FIRST) * bf->height + y];
+        ink = (bits >> (x % bf->width)) & 1;
+        }
+      if (ink && start < 0)
+        start = x;
+      else if (!ink && start >= 0)
+        {
+        if (*n == max)
+          {
+          max = max ? max * 2 : 64;
+          spans = realloc (spans, max * sizeof (TextSpan));
+          }
+        spans[*n].y = y;
+        spans[*n].x1 = start;
+        spans[*n].x2 = x;
+        (*n)++;
+        start = -1;
+        }
+      }
+    }
+  return spans;
+  }
+
+
+/*==========================================================================
+
+  text_cache_evict
+
+  Throw away the least recently used strings until there is room for
+  size more bytes
+
+*==========================================================================*/
+static void text_cache_evict (long size)
+  {
+  while (count > 0 && used + size > budget)
+    {
+    int oldest = 0;
+    for (int i = 1; i < count; i++)
+      {
+      if (entries[i].last_used < entries[oldest].last_used)
+        oldest = i;
+      }
+    TextEntry *e = &entries[oldest];
+    used -= e->size;
+    stats_add ("text.bytes", -e->size);
+    stats_add ("text.evictions", 1);
+    free (e->text);
+    free (e->spans);
+    *e = entries[--count];
+    }
+  }
+
+
+/*==========================================================================
+
+  text_cache_get
+
+  The runs of pixels that make up text, drawn in the font, and their
+  number. Returns NULL if the cache is turned off, or the string is 
+  too big for it, in which case the caller should draw the text itself
+
+*==========================================================================*/
+const TextSpan *text_cache_get (const BitmapFont *bf, const char *text,
+      int *n_spans)
+  {
+  // Span positions are 16-bit
+  if (budget <= 0 || strlen (text) * bf->width > INT16_MAX) return NULL;
+  for (int i = 0; i < count; i++)
+    {
+    TextEntry *e = &entries[i];
+    if (e->font == bf && strcmp (e->text, text) == 0)
+      {
+      stats_add ("text.hits", 1);
+      e->last_used = ++ticks;
+      *n_spans = e->n_spans;
+      return e->spans;
+      }
+    }
+
+  stats_add ("text.misses", 1);
+  int n;
+  TextSpan *spans = text_cache_render (bf, text, &n);
+  long size = sizeof (TextEntry) + strlen (text) + 1 
+    + n * sizeof (TextSpan);
+  if (size > budget)
+    {
+    free (spans);
+    return NULL;
+    }
+  text_cache_evict (size);
+  if (count == capacity)
+    {
+    capacity = capacity ? capacity * 2 : 32;
+    entries = realloc (entries, capacity * sizeof (TextEntry));
+    }
+  TextEntry *e = &entries[count++];
+  e->font = bf;
+  e->text = strdup (text);
+  e->spans = spans;
+  e->n_spans = n;
+  e->size = size;
+  e->last_used = ++ticks;
+  used += size;
+  stats_add ("text.bytes", size);
+  *n_spans = n;
+  return spans;
+  }
+
+
+/*==========================================================================
+  text_cache_free
+*==========================================================================*/
+void text_cache_free (void)
+  {
+  LOG_IN
+  for (int i = 0; i < count; i++)
+    {
+    free (entries[i].text);
+    free (entries[i].spans);
+    }
+  stats_add ("text.bytes", -used);
+  free (entries);
+  entries = NULL;
+  count = 0;
+  capacity = 0;
+  used = 0;
+  LOG_OUT
+  }
+
@@ -0,0 +1,31 @@
+/*============================================================================
+
+  fbclock
+  textcache.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "bitmap_font.h"
+
+// A horizontal run of inked pixels in a rendered string, from x1 to x2
+//   (excluded), relative to the top left corner of the text
+typedef struct _TextSpan
+  {
+  int16_t y;
+  int16_t x1;
+  int16_t x2;
+  } TextSpan;
+
+BEGIN_DECLS
+
+void            text_cache_set_budget (long budget);
+const TextSpan *text_cache_get (const BitmapFont *bf, const char *text,
+                   int *n_spans);
+void            text_cache_free (void);
+
+END_DECLS
+
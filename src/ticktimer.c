@@ -0,0 +1,174 @@
+/*============================================================================
+
+  fbclock
+  ticktimer.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Wakes the program on each boundary of the wall clock -- each second,
+  or each minute -- so that the clock changes as close as possible to
+  the moment the time does. Sleeping for a tick after drawing would
+  make each update late by up to a tick, and later still by the time
+  taken to draw.
+
+  This is a timerfd on CLOCK_REALTIME, armed with an absolute time for
+  the next boundary. Because it is set with TFD_TIMER_CANCEL_ON_SET, 
+  if the wall clock is set -- by hand, or by NTP stepping it -- the 
+  timer fires straight away, so the clock is redrawn at once, and the 
+  timer is armed again for the new time. How late each wakeup is, 
+  relative to the boundary, is logged at debug level, and kept in 
+  the statistics. The program's event loop waits for the timer to 
+  become readable.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include "defs.h"
+#include "log.h"
+#include "stats.h"
+#include "ticktimer.h"
+
+struct _TickTimer
+  {
+  int fd;
+  int tick;
+  // The boundary that the timer is armed for
+  time_t due;
+  };
+
+
+/*==========================================================================
+
+  tick_timer_arm
+
+  Arm the timer for the first boundary after the current time
+
+*==========================================================================*/
+static void tick_timer_arm (TickTimer *self)
+  {
+  struct timespec now;
+  clock_gettime (CLOCK_REALTIME, &now);
+  self->due = (now.tv_sec / self->tick + 1) * self->tick;
+  struct itimerspec its;
+  memset (&its, 0, sizeof (its));
+  its.it_value.tv_sec = self->due;
+  if (timerfd_settime (self->fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+        &its, NULL) != 0)
+    log_warning ("Can't set tick timer: %s", strerror (errno));
+  }
+
+
+/*==========================================================================
+
+  tick_timer_create
+
+  Create a timer that fires every tick seconds, on the multiples of 
+  tick since the epoch -- for a tick of 60, that is each minute.
+  Returns NULL, having logged the reason, if the timer can't be made
+
+*==========================================================================*/
+TickTimer *tick_timer_create (int tick)
+  {
+  LOG_IN
+  TickTimer *self = NULL;
+  int fd = timerfd_create (CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd >= 0)
+    {
+    self = malloc (sizeof (TickTimer));
+    self->fd = fd;
+    self->tick = tick < 1 ? 1 : tick;
+    tick_timer_arm (self);
+    }
+  else
+    log_error ("Can't create tick timer: %s", strerror (errno));
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  tick_timer_destroy
+*==========================================================================*/
+void tick_timer_destroy (TickTimer *self)
+  {
+  LOG_IN
+  close (self->fd);
+  free (self);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  tick_timer_get_fd
+
+  The timer, which becomes readable at each boundary, and when the wall
+  clock is set
+
+*==========================================================================*/
+int tick_timer_get_fd (const TickTimer *self)
+  {
+  return self->fd;
+  }
+
+
+/*==========================================================================
+
+  tick_timer_get_due
+
+  The boundary that the timer will next fire at, if the wall clock 
+  isn't set first
+
+*==========================================================================*/
+void tick_timer_get_due (const TickTimer *self, struct timespec *when)
+  {
+  when->tv_sec = self->due;
+  when->tv_nsec = 0;
+  }
+
+
+/*==========================================================================
+
+  tick_timer_expired
+
+  Call this when the timer is readable. Returns TRUE, and sets when to
+  the time to show, if the clock should be redrawn
+
+*==========================================================================*/
+BOOL tick_timer_expired (TickTimer *self, struct timespec *when)
+  {
+  uint64_t expirations;
+  ssize_t n = read (self->fd, &expirations, sizeof (expirations));
+  if (n < 0 && errno == EAGAIN) return FALSE;
+
+  struct timespec now;
+  clock_gettime (CLOCK_REALTIME, &now);
+  if (n < 0 && errno == ECANCELED)
+    {
+    log_debug ("Wall clock was set; redrawing");
+    stats_add ("tick.clock_changes", 1);
+    }
+  else if (n < 0)
+    log_warning ("Can't read tick timer: %s", strerror (errno));
+  else
+    {
+    long late = (now.tv_sec - self->due) * 1000000 + now.tv_nsec / 1000;
+    log_debug ("Tick %ld usec late", late);
+    stats_add ("tick.wakeups", 1);
+    stats_set ("tick.late_usec", late);
+    if (late > stats_get ("tick.max_late_usec"))
+      stats_set ("tick.max_late_usec", late);
+    }
+  tick_timer_arm (self);
+
+  when->tv_sec = now.tv_sec;
+  when->tv_nsec = 0;
+  return TRUE;
+  }
+
@@ -0,0 +1,26 @@
+/*============================================================================
+
+  fbclock
+  ticktimer.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <time.h>
+#include "defs.h"
+
+struct _TickTimer;
+typedef struct _TickTimer TickTimer;
+
+BEGIN_DECLS
+
+TickTimer *tick_timer_create (int tick);
+void       tick_timer_destroy (TickTimer *self);
+int        tick_timer_get_fd (const TickTimer *self);
+void       tick_timer_get_due (const TickTimer *self, struct timespec *when);
+BOOL       tick_timer_expired (TickTimer *self, struct timespec *when);
+
+END_DECLS
+
@@ -0,0 +1,118 @@
+/*============================================================================
+
+  fbclock
+  trig.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Table-driven, fixed-point trigonometry, for the geometry of the clock.
+  The floating-point functions in libm are slow on processors without
+  an FPU, and we only ever need a few thousand distinct angles, at the
+  precision of a pixel. The tables are built the first time they are
+  used, which is the only time libm is called.
+
+  The sine table covers a quarter turn, and the other quadrants are
+  found by symmetry. The arctangent table covers ratios from 0 to 1,
+  and is interpolated; other ratios are found by symmetry too. Over 
+  the whole circle, sines and cosines are within one part in 65536 of 
+  libm's, and arctangents, which are rounded to the nearest step, are
+  within a step.
+
+============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "defs.h"
+#include "trig.h"
+
+#define QUARTER (TRIG_STEPS / 4)
+
+// The arctangent table has this many intervals between ratios 0 and 1
+#define ATAN_BITS 8
+#define ATAN_SIZE (1 << ATAN_BITS)
+
+static int32_t sin_table[QUARTER + 1];
+// Arctangents, in sixteenths of a step
+static int32_t atan_table[ATAN_SIZE + 1];
+static BOOL tables_built = FALSE;
+
+
+/*==========================================================================
+  trig_build_tables
+*==========================================================================*/
+static void trig_build_tables (void)
+  {
+  for (int i = 0; i <= QUARTER; i++)
+    sin_table[i] = (int32_t) lround (sin (i * 2 * M_PI / TRIG_STEPS) 
+      * TRIG_ONE);
+  for (int i = 0; i <= ATAN_SIZE; i++)
+    atan_table[i] = (int32_t) lround (atan ((double) i / ATAN_SIZE) 
+      * TRIG_STEPS * 16 / (2 * M_PI));
+  tables_built = TRUE;
+  }
+
+
+/*==========================================================================
+
+  trig_sin
+
+  The sine of an angle in steps, which can be any integer, as a 
+  fixed-point number with TRIG_SHIFT fractional bits
+
+*==========================================================================*/
+int32_t trig_sin (int angle)
+  {
+  if (!tables_built) trig_build_tables ();
+  angle %= TRIG_STEPS;
+  if (angle < 0) angle += TRIG_STEPS;
+  if (angle <= QUARTER) return sin_table[angle];
+  if (angle <= 2 * QUARTER) return sin_table[2 * QUARTER - angle];
+  if (angle <= 3 * QUARTER) return -sin_table[angle - 2 * QUARTER];
+  return -sin_table[TRIG_STEPS - angle];
+  }
+
+
+/*==========================================================================
+  trig_cos
+*==========================================================================*/
+int32_t trig_cos (int angle)
+  {
+  return trig_sin (angle + QUARTER);
+  }
+
+
+/*==========================================================================
+
+  trig_atan2
+
+  The angle, in steps from 0 to TRIG_STEPS - 1, of the direction 
+  (x,y), measured from the x axis towards the y axis, like libm's 
+  atan2. The angle of (0,0) is 0
+
+*==========================================================================*/
+int trig_atan2 (int y, int x)
+  {
+  if (!tables_built) trig_build_tables ();
+  int64_t ax = x < 0 ? -(int64_t)x : x;
+  int64_t ay = y < 0 ? -(int64_t)y : y;
+  if (ax == 0 && ay == 0) return 0;
+
+  // The ratio of the smaller to the larger, with 16 fractional bits 
+  //   beyond the table index
+  int64_t big = ax > ay ? ax : ay;
+  int64_t small = ax > ay ? ay : ax;
+  int64_t ratio = (small << (ATAN_BITS + 16)) / big;
+  int i = ratio >> 16;
+  int frac = ratio & 0xFFFF;
+  int32_t a = atan_table[i];
+  if (i < ATAN_SIZE)
+    a += (int32_t)(((int64_t)(atan_table[i + 1] - a) * frac) >> 16);
+  int angle = (a + 8) / 16;
+
+  if (ay > ax) angle = QUARTER - angle;
+  if (x < 0) angle = 2 * QUARTER - angle;
+  if (y < 0) angle = TRIG_STEPS - angle;
+  if (angle >= TRIG_STEPS) angle -= TRIG_STEPS;
+  return angle;
+  }
+
@@ -0,0 +1,41 @@
+/*============================================================================
+
+  fbclock
+  trig.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+// Angles are measured in steps, TRIG_STEPS to a full turn. 3600 steps
+//   means that every position of every clock hand, and every numeral,
+//   falls exactly on a step
+#define TRIG_STEPS 3600
+
+// Sines and cosines are fixed-point numbers, with this many fractional
+//   bits
+#define TRIG_SHIFT 16
+#define TRIG_ONE (1 << TRIG_SHIFT)
+
+BEGIN_DECLS
+
+int32_t  trig_sin (int angle);
+int32_t  trig_cos (int angle);
+int      trig_atan2 (int y, int x);
+
+END_DECLS
+
+/*==========================================================================
+  trig_mul
+
+  Multiply an integer by a fixed-point sine or cosine, truncating the
+  result towards zero, as a conversion from floating point would
+*==========================================================================*/
+static inline int trig_mul (int n, int32_t f)
+  {
+  return (int)(((int64_t)n * f) / TRIG_ONE);
+  }
+
@@ -0,0 +1,210 @@
+/*============================================================================
+
+  fbclock
+  tzcache.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Converts times to local time for the clock, without asking the C 
+  library to do it every frame. The broken-down time is kept for the
+  local minute that the last conversion fell in, and any time in the
+  same minute is worked out from it by setting the seconds, which is 
+  right as long as the UTC offset only changes on a minute boundary, 
+  as it does in every time zone in use. localtime_r is called once a 
+  minute at most.
+
+  The C library reads the time zone file once, and doesn't notice if
+  it changes, so a clock that runs for months wouldn't follow the 
+  system's time zone being changed. Instead, the zone file -- the one
+  that TZ names, or /etc/localtime -- is watched with inotify, and 
+  when it is replaced or rewritten, the C library is made to read it 
+  again, and the cached time is thrown away. The directory is watched,
+  not the file, because /etc/localtime is usually a symbolic link, 
+  and is changed by replacing the link.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "defs.h"
+#include "log.h"
+#include "stats.h"
+#include "tzcache.h"
+
+#define TZ_DEFAULT "/etc/localtime"
+#define TZ_DIR "/usr/share/zoneinfo"
+
+static int fd = -1;
+// The name, within the watched directory, of the zone file
+static char *file_name = NULL;
+// The start of the cached minute, and its broken-down time, with 
+//   seconds of zero
+static BOOL valid = FALSE;
+static time_t minute_start;
+static struct tm minute_tm;
+
+
+/*==========================================================================
+
+  tz_cache_zone_file
+
+  Work out which file the C library takes the time zone from: the 
+  file TZ names, if it names one, or /etc/localtime if TZ is not set. 
+  Returns NULL if TZ is a rule, like EST5EDT, rather than a file
+
+*==========================================================================*/
+static char *tz_cache_zone_file (void)
+  {
+  const char *tz = getenv ("TZ");
+  if (tz == NULL) return strdup (TZ_DEFAULT);
+  if (*tz == ':') tz++;
+  if (*tz == '/') return strdup (tz);
+  char *path;
+  asprintf (&path, TZ_DIR "/%s", tz);
+  if (*tz && access (path, R_OK) == 0) return path;
+  free (path);
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  tz_cache_init
+
+  Start watching the time zone file. Returns a file descriptor that 
+  becomes readable when it changes, for the caller to wait on, or -1 
+  if it can't be watched -- in which case times are still cached, 
+  and the time zone never changes
+
+*==========================================================================*/
+int tz_cache_init (void)
+  {
+  LOG_IN
+  tzset ();
+  char *path = tz_cache_zone_file ();
+  if (path)
+    {
+    char *slash = strrchr (path, '/');
+    *slash = 0;
+    const char *dir = slash == path ? "/" : path;
+    fd = inotify_init1 (IN_CLOEXEC | IN_NONBLOCK);
+    if (fd >= 0 && inotify_add_watch (fd, dir, IN_CREATE | IN_MOVED_TO 
+          | IN_CLOSE_WRITE | IN_DELETE) >= 0)
+      {
+      file_name = strdup (slash + 1);
+      log_debug ("Watching %s/%s for time zone changes", dir, file_name);
+      }
+    else
+      {
+      log_warning ("Can't watch for time zone changes: %s", 
+        strerror (errno));
+      if (fd >= 0) close (fd);
+      fd = -1;
+      }
+    free (path);
+    }
+  LOG_OUT
+  return fd;
+  }
+
+
+/*==========================================================================
+
+  tz_cache_reload
+
+  Make the C library read the time zone again. tzset() re-reads
+  /etc/localtime when TZ is not set, but when it is, tzset() does 
+  nothing unless the value of TZ has changed, so it is changed and 
+  changed back
+
+*==========================================================================*/
+static void tz_cache_reload (void)
+  {
+  const char *tz = getenv ("TZ");
+  if (tz)
+    {
+    char *saved = strdup (tz);
+    setenv ("TZ", "UTC0", 1);
+    tzset ();
+    setenv ("TZ", saved, 1);
+    free (saved);
+    }
+  tzset ();
+  }
+
+
+/*==========================================================================
+
+  tz_cache_handle_events
+
+  Call this when the file descriptor from tz_cache_init is readable.
+  Returns TRUE if the time zone file has changed, in which case the 
+  clock should be redrawn
+
+*==========================================================================*/
+BOOL tz_cache_handle_events (void)
+  {
+  BOOL changed = FALSE;
+  char buf[4096] 
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t n;
+  while ((n = read (fd, buf, sizeof (buf))) > 0)
+    {
+    for (char *p = buf; p < buf + n; )
+      {
+      const struct inotify_event *e = (const struct inotify_event *)p;
+      if (e->len > 0 && strcmp (e->name, file_name) == 0) changed = TRUE;
+      p += sizeof (struct inotify_event) + e->len;
+      }
+    }
+  if (changed)
+    {
+    tz_cache_reload ();
+    valid = FALSE;
+    stats_add ("tz.reloads", 1);
+    log_info ("Time zone changed");
+    }
+  return changed;
+  }
+
+
+/*==========================================================================
+
+  tz_cache_localtime
+
+  Convert t to local time, as localtime_r would
+
+*==========================================================================*/
+void tz_cache_localtime (time_t t, struct tm *tm)
+  {
+  if (!valid || t < minute_start || t >= minute_start + 60)
+    {
+    localtime_r (&t, &minute_tm);
+    minute_start = t - minute_tm.tm_sec;
+    minute_tm.tm_sec = 0;
+    valid = TRUE;
+    stats_add ("tz.conversions", 1);
+    }
+  *tm = minute_tm;
+  tm->tm_sec = t - minute_start;
+  }
+
+
+/*==========================================================================
+  tz_cache_free
+*==========================================================================*/
+void tz_cache_free (void)
+  {
+  LOG_IN
+  if (fd >= 0) close (fd);
+  fd = -1;
+  free (file_name);
+  file_name = NULL;
+  valid = FALSE;
+  LOG_OUT
+  }
+
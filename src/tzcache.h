@@ -0,0 +1,22 @@
+/*============================================================================
+
+  fbclock
+  tzcache.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <time.h>
+#include "defs.h"
+
+BEGIN_DECLS
+
+int   tz_cache_init (void);
+BOOL  tz_cache_handle_events (void);
+void  tz_cache_localtime (time_t t, struct tm *tm);
+void  tz_cache_free (void);
+
+END_DECLS
+
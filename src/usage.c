@@ -23,12 +23,26 @@ void usage_show (FILE *fout, const char *argv0)
   {
   fprintf (fout, "Usage: %s [options]\n", argv0);
   fprintf (fout, "  -?,--help            show this message\n");
+  fprintf (fout, "     --benchmark=N     draw N frames at full speed, and exit\n");
+  fprintf (fout, "     --benchmark-op=OP time N of a drawing operation: lines,\n");
+  fprintf (fout, "                         resample, glyphs\n");
   fprintf (fout, "  -d,--date            show date\n");
-  fprintf (fout, "  -f,--fbdev=device    framebuffer device (/dev/fb0)\n");
+  fprintf (fout, "     --deferred-io     write only changed words (fbtft)\n");
+  fprintf (fout, "  -f,--fbdev=device    framebuffer device (/dev/fb0),\n");
+  fprintf (fout, "                         or mem:WxH[xD] for offscreen\n");
+  fprintf (fout, "                         (repeat for more displays)\n");
+  fprintf (fout, "     --hand-cache=KB   memory for cached hands (4096; 0=off)\n");
   fprintf (fout, "  -h,--height=N         display height\n");
   fprintf (fout, "     --log-level=N     log level, 0-5 (default 2)\n");
+  fprintf (fout, "     --page-flip       draw off-screen and pan (implies vsync)\n");
+  fprintf (fout, "     --render-ahead    draw each frame before it is due\n");
+  fprintf (fout, "     --shadow          keep a copy of the clock area in memory\n");
   fprintf (fout, "  -s,--seconds         show seconds\n");
+  fprintf (fout, "     --sweep=FPS       sweep the second hand, at FPS frames/sec\n");
+  fprintf (fout, "     --text-cache=KB   memory for cached labels (64; 0=off)\n");
+  fprintf (fout, "     --threads=N       threads to draw with (1)\n");
   fprintf (fout, "  -v,--version         show version\n");
+  fprintf (fout, "     --vsync           update during vertical blank\n");
   fprintf (fout, "  -w,--width=N         display width\n");
   fprintf (fout, "  -t,--transparency=%%  transparency\n");
   fprintf (fout, "  -x,--x=N             display x position\n");
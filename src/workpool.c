@@ -0,0 +1,279 @@
+/*============================================================================
+
+  fbclock
+  workpool.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  A set of threads that carry out batches of independent tasks, like 
+  drawing the tiles of a region. The threads are started once, and 
+  wait between batches, so a batch costs a wakeup, not a thread 
+  creation. The thread that asks for a batch to be run works on it 
+  too.
+
+  Each batch is numbered tasks 0 to n-1, which are shared out between
+  the threads in contiguous ranges, so that neighbouring tiles tend to
+  be drawn by the same thread. A thread works forwards through its own
+  range; when that is exhausted, it steals tasks from the far end of 
+  the others' ranges, so that a thread that was given the expensive 
+  tiles doesn't hold up the rest. A range is a single 64-bit word, 
+  its start and end, and both taking and stealing are a 
+  compare-and-swap on it.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "defs.h"
+#include "log.h"
+#include "stats.h"
+#include "workpool.h"
+
+// Each thread's range is on its own cache line, so that taking tasks
+//   from one doesn't slow down the others
+typedef struct _WorkRange
+  {
+  _Atomic uint64_t range; // First task in the top 32 bits, end below
+  int steals;
+  } __attribute__ ((aligned (64))) WorkRange;
+
+typedef struct _Worker
+  {
+  WorkPool *pool;
+  int index;
+  pthread_t thread;
+  } Worker;
+
+struct _WorkPool
+  {
+  // Including the thread that calls work_pool_run, which is number 0
+  int threads;
+  Worker *workers;
+  WorkRange *ranges;
+  pthread_mutex_t lock;
+  // Signalled when a batch starts, and when the pool is destroyed
+  pthread_cond_t start;
+  // Signalled when the last thread runs out of work
+  pthread_cond_t finished;
+  int batch;
+  int busy;
+  BOOL quit;
+  WorkFn fn;
+  void *arg;
+  };
+
+
+/*==========================================================================
+
+  work_pool_take
+
+  Take a task from thread victim's range: the first one, if victim is
+  the thread asking, or the last one, if it is stealing. Returns -1 if
+  the range is empty
+
+*==========================================================================*/
+static int work_pool_take (WorkPool *self, int victim, BOOL steal)
+  {
+  _Atomic uint64_t *range = &self->ranges[victim].range;
+  uint64_t r = atomic_load (range);
+  for (;;)
+    {
+    uint32_t first = r >> 32;
+    uint32_t end = (uint32_t)r;
+    if (first >= end) return -1;
+    uint64_t next = steal ? r - 1 : r + ((uint64_t)1 << 32);
+    if (atomic_compare_exchange_weak (range, &r, next))
+      return steal ? (int)end - 1 : (int)first;
+    }
+  }
+
+
+/*==========================================================================
+
+  work_pool_work
+
+  Carry out tasks until there are none left anywhere
+
+*==========================================================================*/
+static void work_pool_work (WorkPool *self, int index)
+  {
+  for (;;)
+    {
+    int task = work_pool_take (self, index, FALSE);
+    for (int i = 1; task < 0 && i < self->threads; i++)
+      {
+      task = work_pool_take (self, (index + i) % self->threads, TRUE);
+      if (task >= 0) self->ranges[index].steals++;
+      }
+    if (task < 0) return;
+    self->fn (self->arg, task);
+    }
+  }
+
+
+/*==========================================================================
+  work_pool_thread
+*==========================================================================*/
+static void *work_pool_thread (void *arg)
+  {
+  Worker *worker = arg;
+  WorkPool *self = worker->pool;
+  int batch = 0;
+  pthread_mutex_lock (&self->lock);
+  for (;;)
+    {
+    while (self->batch == batch && !self->quit)
+      pthread_cond_wait (&self->start, &self->lock);
+    if (self->quit) break;
+    batch = self->batch;
+    pthread_mutex_unlock (&self->lock);
+
+    work_pool_work (self, worker->index);
+
+    pthread_mutex_lock (&self->lock);
+    if (--self->busy == 0)
+      pthread_cond_signal (&self->finished);
+    }
+  pthread_mutex_unlock (&self->lock);
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  work_pool_create
+
+  Create a pool of threads threads, counting the one that will call
+  work_pool_run. With one thread, tasks are run one after another by
+  the caller. If threads can't be started, the pool has fewer than
+  requested
+
+*==========================================================================*/
+WorkPool *work_pool_create (int threads)
+  {
+  LOG_IN
+  if (threads < 1) threads = 1;
+  WorkPool *self = malloc (sizeof (WorkPool));
+  self->workers = calloc (threads, sizeof (Worker));
+  if (posix_memalign ((void **)&self->ranges, 64, 
+        threads * sizeof (WorkRange)) != 0)
+    {
+    self->ranges = NULL;
+    threads = 1;
+    }
+  for (int i = 0; i < threads && self->ranges; i++)
+    {
+    atomic_init (&self->ranges[i].range, 0);
+    self->ranges[i].steals = 0;
+    }
+  pthread_mutex_init (&self->lock, NULL);
+  pthread_cond_init (&self->start, NULL);
+  pthread_cond_init (&self->finished, NULL);
+  self->batch = 0;
+  self->busy = 0;
+  self->quit = FALSE;
+  self->threads = 1;
+  for (int i = 1; i < threads; i++)
+    {
+    Worker *w = &self->workers[i];
+    w->pool = self;
+    w->index = i;
+    if (pthread_create (&w->thread, NULL, work_pool_thread, w) != 0)
+      {
+      log_warning ("Can't start worker thread; using %d", i);
+      break;
+      }
+    self->threads = i + 1;
+    }
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  work_pool_destroy
+*==========================================================================*/
+void work_pool_destroy (WorkPool *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->lock);
+    self->quit = TRUE;
+    pthread_cond_broadcast (&self->start);
+    pthread_mutex_unlock (&self->lock);
+    for (int i = 1; i < self->threads; i++)
+      pthread_join (self->workers[i].thread, NULL);
+    pthread_cond_destroy (&self->finished);
+    pthread_cond_destroy (&self->start);
+    pthread_mutex_destroy (&self->lock);
+    free (self->ranges);
+    free (self->workers);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  work_pool_get_threads
+*==========================================================================*/
+int work_pool_get_threads (const WorkPool *self)
+  {
+  return self->threads;
+  }
+
+
+/*==========================================================================
+
+  work_pool_run
+
+  Carry out tasks 0 to tasks-1, by calling fn for each, in no 
+  particular order, and on any thread. Returns when all of them are
+  finished. This must only be called from one thread
+
+*==========================================================================*/
+void work_pool_run (WorkPool *self, int tasks, WorkFn fn, void *arg)
+  {
+  if (self->threads == 1 || tasks <= 1)
+    {
+    for (int i = 0; i < tasks; i++)
+      fn (arg, i);
+    return;
+    }
+
+  for (int i = 0; i < self->threads; i++)
+    {
+    uint64_t first = (int64_t)tasks * i / self->threads;
+    uint64_t end = (int64_t)tasks * (i + 1) / self->threads;
+    atomic_store (&self->ranges[i].range, first << 32 | end);
+    }
+
+  pthread_mutex_lock (&self->lock);
+  self->fn = fn;
+  self->arg = arg;
+  self->busy = self->threads - 1;
+  self->batch++;
+  pthread_cond_broadcast (&self->start);
+  pthread_mutex_unlock (&self->lock);
+
+  work_pool_work (self, 0);
+
+  pthread_mutex_lock (&self->lock);
+  while (self->busy > 0)
+    pthread_cond_wait (&self->finished, &self->lock);
+  pthread_mutex_unlock (&self->lock);
+
+  int steals = 0;
+  for (int i = 0; i < self->threads; i++)
+    {
+    steals += self->ranges[i].steals;
+    self->ranges[i].steals = 0;
+    }
+  stats_add ("pool.batches", 1);
+  stats_add ("pool.tasks", tasks);
+  stats_add ("pool.steals", steals);
+  }
+
@@ -0,0 +1,28 @@
+/*============================================================================
+
+  fbclock
+  workpool.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _WorkPool;
+typedef struct _WorkPool WorkPool;
+
+// Carry out task number task. arg is whatever was passed to 
+//   work_pool_run
+typedef void (*WorkFn) (void *arg, int task);
+
+BEGIN_DECLS
+
+WorkPool *work_pool_create (int threads);
+void      work_pool_destroy (WorkPool *self);
+int       work_pool_get_threads (const WorkPool *self);
+void      work_pool_run (WorkPool *self, int tasks, WorkFn fn, void *arg);
+
+END_DECLS
+
@@ -0,0 +1,181 @@
+/*============================================================================
+
+  fbclock
+  trig_test.c
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+  Checks the fixed-point trigonometry in trig.c against libm, and times
+  both. Every one of the TRIG_STEPS angles is checked for sine and
+  cosine, and every direction from the centre of a 600x600 box -- the
+  largest clock that is usual -- for the arctangent. Exits with status
+  1 if any result is further from libm's than the bounds below. Run
+  by "make check".
+
+============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "defs.h"
+#include "trig.h"
+
+// Sines and cosines should be within half of the last fractional bit,
+//   allowing for rounding in the comparison itself
+#define SIN_BOUND (0.5 / TRIG_ONE + 1e-12)
+// Arctangents are rounded to the nearest step from an interpolated
+//   table, so they are a little over half a step out at worst: 0.53
+//   steps, to two places
+#define ATAN_BOUND 0.535
+
+#define BOX 600
+#define SIN_REPEATS 1000
+#define ATAN_REPEATS 10
+
+// Results go here, so the timed loops are not optimized away
+static volatile int64_t sink;
+static volatile double fsink;
+
+
+/*==========================================================================
+  trig_test_now
+*==========================================================================*/
+static int64_t trig_test_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+
+/*==========================================================================
+
+  trig_test_sin
+
+  Returns the largest difference of trig_sin and trig_cos from libm,
+  over all angles, as a fraction of one
+
+*==========================================================================*/
+static double trig_test_sin (void)
+  {
+  double worst = 0;
+  for (int a = 0; a < TRIG_STEPS; a++)
+    {
+    double rad = a * 2 * M_PI / TRIG_STEPS;
+    double es = fabs ((double)trig_sin (a) / TRIG_ONE - sin (rad));
+    double ec = fabs ((double)trig_cos (a) / TRIG_ONE - cos (rad));
+    if (es > worst) worst = es;
+    if (ec > worst) worst = ec;
+    }
+  return worst;
+  }
+
+
+/*==========================================================================
+
+  trig_test_atan2
+
+  Returns the largest difference of trig_atan2 from libm, in steps, over
+  every direction in the box. Angles either side of zero are compared
+  the short way round
+
+*==========================================================================*/
+static double trig_test_atan2 (void)
+  {
+  double worst = 0;
+  for (int y = -BOX / 2; y <= BOX / 2; y++)
+    for (int x = -BOX / 2; x <= BOX / 2; x++)
+      {
+      if (x == 0 && y == 0) continue;
+      double ref = atan2 (y, x) * TRIG_STEPS / (2 * M_PI);
+      if (ref < 0) ref += TRIG_STEPS;
+      double e = fabs (trig_atan2 (y, x) - ref);
+      if (e > TRIG_STEPS / 2) e = TRIG_STEPS - e;
+      if (e > worst) worst = e;
+      }
+  return worst;
+  }
+
+
+/*==========================================================================
+
+  trig_test_time
+
+  Time each function against its libm equivalent, in nanoseconds per
+  call
+
+*==========================================================================*/
+static void trig_test_time (void)
+  {
+  int64_t start = trig_test_now ();
+  int64_t sum = 0;
+  for (int r = 0; r < SIN_REPEATS; r++)
+    for (int a = 0; a < TRIG_STEPS; a++)
+      sum += trig_sin (a);
+  sink = sum;
+  double t_sin = (double)(trig_test_now () - start)
+    / (SIN_REPEATS * TRIG_STEPS);
+
+  start = trig_test_now ();
+  double fsum = 0;
+  for (int r = 0; r < SIN_REPEATS; r++)
+    for (int a = 0; a < TRIG_STEPS; a++)
+      fsum += sin (a * 2 * M_PI / TRIG_STEPS);
+  fsink = fsum;
+  double t_libm_sin = (double)(trig_test_now () - start)
+    / (SIN_REPEATS * TRIG_STEPS);
+
+  int64_t calls = (int64_t)ATAN_REPEATS * (BOX + 1) * (BOX + 1);
+  start = trig_test_now ();
+  sum = 0;
+  for (int r = 0; r < ATAN_REPEATS; r++)
+    for (int y = -BOX / 2; y <= BOX / 2; y++)
+      for (int x = -BOX / 2; x <= BOX / 2; x++)
+        sum += trig_atan2 (y, x);
+  sink = sum;
+  double t_atan = (double)(trig_test_now () - start) / calls;
+
+  start = trig_test_now ();
+  fsum = 0;
+  for (int r = 0; r < ATAN_REPEATS; r++)
+    for (int y = -BOX / 2; y <= BOX / 2; y++)
+      for (int x = -BOX / 2; x <= BOX / 2; x++)
+        fsum += atan2 (y, x);
+  fsink = fsum;
+  double t_libm_atan = (double)(trig_test_now () - start) / calls;
+
+  printf ("trig_sin: %.1f ns, sin: %.1f ns\n", t_sin, t_libm_sin);
+  printf ("trig_atan2: %.1f ns, atan2: %.1f ns\n", t_atan, t_libm_atan);
+  }
+
+
+/*==========================================================================
+  main
+*==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int ret = 0;
+
+  double e_sin = trig_test_sin ();
+  printf ("sin/cos: %d angles, largest error %.3f/%d\n", TRIG_STEPS,
+    e_sin * TRIG_ONE, TRIG_ONE);
+  if (e_sin > SIN_BOUND)
+    {
+    printf ("FAIL: sin/cos error is more than %.3f/%d\n",
+      SIN_BOUND * TRIG_ONE, TRIG_ONE);
+    ret = 1;
+    }
+
+  double e_atan = trig_test_atan2 ();
+  printf ("atan2: %dx%d box, largest error %.4f steps\n", BOX, BOX,
+    e_atan);
+  if (e_atan > ATAN_BOUND)
+    {
+    printf ("FAIL: atan2 error is more than %.3f steps\n", ATAN_BOUND);
+    ret = 1;
+    }
+
+  trig_test_time ();
+  return ret;
+  }
+